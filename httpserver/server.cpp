@@ -25,6 +25,7 @@
 
 #include "wookie/storage.hpp"
 #include "wookie/basic_elliptics_splitter.hpp"
+#include "wookie/recrawl.hpp"
 #include "wookie/split.hpp"
 #include "wookie/operators.hpp"
 
@@ -86,6 +87,25 @@ struct on_upload : public rift::io::on_upload<T>
 			return;
 		}
 
+		// crawler checks freshness by metadata record only, uploaded document gets it as well
+		document_meta meta;
+		meta.ts = m_doc.ts;
+		meta.size = m_doc.data.size();
+		meta.content_hash = recrawl_policy::content_hash(m_doc.data);
+		meta.status = swarm::url_fetcher::response::ok;
+
+		this->server()->get_storage().write_document_meta(m_doc.key, meta)
+			.connect(std::bind(&on_upload<T>::on_meta_written_update_index,
+				this->shared_from_this(), result, std::placeholders::_1, std::placeholders::_2));
+	}
+
+	void on_meta_written_update_index(const ioremap::elliptics::sync_write_result &result,
+			const wookie::sync_write_result &, const ioremap::elliptics::error_info &error) {
+		if (error) {
+			this->send_reply(swarm::url_fetcher::response::service_unavailable);
+			return;
+		}
+
 		std::vector<std::string> ids;
 		std::vector<elliptics::data_pointer> objs;
 
@@ -98,24 +118,22 @@ struct on_upload : public rift::io::on_upload<T>
 			thevoid::simple_request_stream<T>::log(ioremap::swarm::SWARM_LOG_INFO,
 					"rindex update: time: %s, url: '%s', index-number: %zd",
 					dnet_print_time(&m_doc.ts), m_doc.key.c_str(), ids.size());
-			ioremap::elliptics::session sess = this->server()->elliptics()->session();
-			sess.set_indexes(m_doc.key, ids, objs)
-				.connect(std::bind(&on_upload<T>::on_index_update_finished,
-					this->shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+
+			// indexes are written in batches together with other uploads, reply is sent when this one is written
+			this->server()->get_storage().indexer().add(m_doc.key, ids, objs,
+					std::bind(&on_upload<T>::on_index_update_finished,
+						this->shared_from_this(), std::placeholders::_1));
 		} else {
 			this->on_write_finished(result, error);
 		}
 	}
 
-	void on_index_update_finished(const ioremap::elliptics::sync_set_indexes_result &result,
-			const ioremap::elliptics::error_info &error) {
+	void on_index_update_finished(const ioremap::elliptics::error_info &error) {
 		if (error) {
 			this->send_reply(swarm::url_fetcher::response::service_unavailable);
 			return;
 		}
 
-		(void) result;
-
 		auto data = m_result_object.ToString();
 
 		swarm::url_fetcher::response reply;
@@ -130,6 +148,28 @@ struct on_upload : public rift::io::on_upload<T>
 template <typename T>
 struct on_get : public rift::io::on_get<T>
 {
+	int m_alias_hops;
+
+	// bucket of the requested key, alias targets are read from the same namespace and groups
+	rift::bucket_meta_raw m_meta;
+
+	// hold read buffer until reply has been sent
+	document_view m_doc;
+	elliptics::data_pointer m_body;
+
+	on_get() : m_alias_hops(0) {
+	}
+
+	std::shared_ptr<on_get> shared_from_this() {
+		return std::static_pointer_cast<on_get>(rift::io::on_get<T>::shared_from_this());
+	}
+
+	virtual void checked(const swarm::http_request &req, const boost::asio::const_buffer &buffer,
+			const rift::bucket_meta_raw &meta, swarm::http_response::status_type verdict) {
+		m_meta = meta;
+		rift::io::on_get<T>::checked(req, buffer, meta, verdict);
+	}
+
 	virtual void on_read_finished(const ioremap::elliptics::sync_read_result &result,
 			const ioremap::elliptics::error_info &error) {
 		if (error.code() == -ENOENT) {
@@ -142,12 +182,33 @@ struct on_get : public rift::io::on_get<T>
 
 		const ioremap::elliptics::read_result_entry &entry = result[0];
 
-		document doc = storage::unpack_document(entry.file());
+		// redirected and near duplicate documents are stored as aliases, read the document they point to
+		if (storage::is_alias(entry.file())) {
+			if (++m_alias_hops > storage::max_alias_hops) {
+				this->send_reply(swarm::url_fetcher::response::service_unavailable);
+				return;
+			}
+
+			document_alias alias = storage::unpack_alias(entry.file());
+			if (alias.rejected()) {
+				this->send_reply(swarm::url_fetcher::response::not_found);
+				return;
+			}
+
+			ioremap::elliptics::session sess = this->server()->bucket_session(m_meta);
+			sess.read_data(alias.target, 0, 0)
+				.connect(std::bind(&on_get<T>::on_read_finished,
+					this->shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+			return;
+		}
+
+		// body is sent straight from the buffer it has been read into
+		m_doc = storage::unpack_document_view(entry.file());
 
 		const swarm::http_request &request = this->request();
 
 		if (auto modified_since = request.headers().if_modified_since()) {
-			if ((time_t)doc.ts.tsec <= *modified_since) {
+			if ((time_t)m_doc.ts.tsec <= *modified_since) {
 				this->send_reply(swarm::url_fetcher::response::not_modified);
 				return;
 			}
@@ -155,11 +216,27 @@ struct on_get : public rift::io::on_get<T>
 
 		swarm::url_fetcher::response reply;
 		reply.set_code(swarm::url_fetcher::response::ok);
-		reply.headers().set_content_length(doc.data.size());
 		reply.headers().set_content_type("text/plain");
-		reply.headers().set_last_modified(doc.ts.tsec);
+		reply.headers().set_last_modified(m_doc.ts.tsec);
+
+		// compressed body is sent as is to clients which accept it, others get it decoded
+		if (m_doc.codec == codec_deflate && accepts_deflate(request)) {
+			m_body = m_doc.data;
+			reply.headers().set("Content-Encoding", "deflate");
+		} else {
+			m_body = m_doc.body();
+		}
+
+		reply.headers().set_content_length(m_body.size());
 
-		this->send_reply(std::move(reply), std::move(doc.data));
+		this->send_headers(std::move(reply),
+				boost::asio::const_buffer(m_body.data(), m_body.size()),
+				std::bind(&on_get<T>::close, this->shared_from_this(), std::placeholders::_1));
+	}
+
+	static bool accepts_deflate(const swarm::http_request &request) {
+		auto encodings = request.headers().get("Accept-Encoding");
+		return encodings && encodings->find("deflate") != std::string::npos;
 	}
 };
 
@@ -287,10 +364,16 @@ public:
 		auto name = query.item_value("name");
 		key = *name;
 
+		elliptics::session session = bucket_session(meta);
+		session.transform(key);
+
+		return session;
+	}
+
+	elliptics::session bucket_session(const rift::bucket_meta_raw &meta) const {
 		elliptics::session session = m_elliptics.session();
 		session.set_namespace(meta.key.c_str(), meta.key.size());
 		session.set_groups(meta.groups);
-		session.transform(key);
 
 		return session;
 	}
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_BLOOM_HPP
+#define __WOOKIE_BLOOM_HPP
+
+#include "wookie/hash.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <stdint.h>
+
+namespace ioremap { namespace wookie {
+
+// Lock-free Bloom filter over strings
+//
+// Its size is fixed at construction time from expected number of elements and
+// acceptable false positive rate, so memory does not grow with crawl size.
+// Filter answers either 'definitely not seen' or 'probably seen', element which has never
+// been inserted is reported as seen with @false_positive probability.
+class bloom_filter {
+	public:
+		bloom_filter(size_t expected, double false_positive = 0.01) {
+			if (!expected)
+				expected = 1;
+
+			const double ln2 = std::log(2.0);
+			size_t bits = std::ceil(-(double)expected * std::log(false_positive) / (ln2 * ln2));
+
+			m_hashes = std::max<int>(1, std::round((double)bits / expected * ln2));
+			reset(bits);
+		}
+
+		// returns true if string was not in the filter before this call
+		bool insert(const std::string &str) {
+			return insert(fingerprint(str));
+		}
+
+		bool contains(const std::string &str) const {
+			return contains(fingerprint(str));
+		}
+
+		// @fp - 64-bit fingerprint of the element, the same one url_table assigns to URLs,
+		// so callers which already have it do not hash string again
+		bool insert(uint64_t fp) {
+			const uint64_t h2 = second_hash(fp);
+
+			bool inserted = false;
+			for (int i = 0; i < m_hashes; ++i) {
+				const uint64_t bit = (fp + i * h2) % m_bits;
+				const uint64_t mask = 1ULL << (bit % 64);
+
+				if (!(m_words[bit / 64].fetch_or(mask) & mask))
+					inserted = true;
+			}
+
+			return inserted;
+		}
+
+		bool contains(uint64_t fp) const {
+			const uint64_t h2 = second_hash(fp);
+
+			for (int i = 0; i < m_hashes; ++i) {
+				const uint64_t bit = (fp + i * h2) % m_bits;
+
+				if (!(m_words[bit / 64].load() & (1ULL << (bit % 64))))
+					return false;
+			}
+
+			return true;
+		}
+
+		static uint64_t fingerprint(const std::string &str) {
+			return hash::murmur(str, 0);
+		}
+
+		// file format: magic, number of bits, number of hashes, tag, bit array
+		// @tag - opaque value filter is only valid with (crawl generation for example), see load()
+		void save(const std::string &path, uint64_t tag) const {
+			std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+			if (!out.good()) {
+				std::ostringstream ss;
+				ss << "bloom: could not open file '" << path << "' for writing";
+				throw std::runtime_error(ss.str());
+			}
+
+			const uint64_t header[4] = { magic, m_bits, (uint64_t)m_hashes, tag };
+			out.write((const char *)header, sizeof(header));
+
+			for (size_t i = 0; i < words(); ++i) {
+				const uint64_t w = m_words[i].load();
+				out.write((const char *)&w, sizeof(w));
+			}
+
+			if (!out.good()) {
+				std::ostringstream ss;
+				ss << "bloom: could not write file '" << path << "'";
+				throw std::runtime_error(ss.str());
+			}
+		}
+
+		// replaces filter content with the one stored in @path, returns false and leaves filter
+		// untouched if there is no such file or it has been saved with other @tag
+		bool load(const std::string &path, uint64_t tag) {
+			std::ifstream in(path.c_str(), std::ios::binary);
+			if (!in.good())
+				return false;
+
+			uint64_t header[4];
+			in.read((char *)header, sizeof(header[0]));
+
+			// filter saved without tag can not be matched to anything
+			if (in.good() && header[0] == magic_v2)
+				return false;
+
+			if (in.good() && header[0] == magic_v1) {
+				std::ostringstream ss;
+				ss << "bloom: file '" << path << "' uses old hashing scheme, it has to be removed";
+				throw std::runtime_error(ss.str());
+			}
+
+			in.read((char *)(header + 1), sizeof(header) - sizeof(header[0]));
+			if (!in.good() || header[0] != magic || !header[1] || !header[2]) {
+				std::ostringstream ss;
+				ss << "bloom: file '" << path << "' is not a bloom filter";
+				throw std::runtime_error(ss.str());
+			}
+
+			if (header[3] != tag)
+				return false;
+
+			reset(header[1]);
+			m_hashes = header[2];
+
+			for (size_t i = 0; i < words(); ++i) {
+				uint64_t w;
+				in.read((char *)&w, sizeof(w));
+				m_words[i].store(w);
+			}
+
+			if (!in.good()) {
+				std::ostringstream ss;
+				ss << "bloom: file '" << path << "' is truncated";
+				throw std::runtime_error(ss.str());
+			}
+
+			return true;
+		}
+
+		size_t bits() const {
+			return m_bits;
+		}
+
+	private:
+		enum {
+			magic_v1 = 0x776b626c6f6f6d31ULL,
+			magic_v2 = 0x776b626c6f6f6d32ULL,
+			magic = 0x776b626c6f6f6d33ULL,
+		};
+
+		uint64_t m_bits;
+		int m_hashes;
+		std::unique_ptr<std::atomic<uint64_t>[]> m_words;
+
+		size_t words() const {
+			return (m_bits + 63) / 64;
+		}
+
+		void reset(uint64_t bits) {
+			m_bits = std::max<uint64_t>(bits, 64);
+			m_words.reset(new std::atomic<uint64_t>[words()]);
+
+			for (size_t i = 0; i < words(); ++i)
+				m_words[i].store(0);
+		}
+
+		// double hashing: i-th hash is fp + i * h2, h2 is derived from fingerprint
+		// by 64-bit finalizer mix, it has to be odd to visit all bits
+		static uint64_t second_hash(uint64_t fp) {
+			fp ^= fp >> 33;
+			fp *= 0xff51afd7ed558ccdULL;
+			fp ^= fp >> 33;
+			fp *= 0xc4ceb9fe1a85ec53ULL;
+			fp ^= fp >> 33;
+
+			return fp | 1;
+		}
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_BLOOM_HPP */
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_CODEC_HPP
+#define __WOOKIE_CODEC_HPP
+
+#include <string>
+
+#include <stddef.h>
+
+namespace ioremap { namespace wookie {
+
+// Encoding of stored document body, value is written into every stored document
+enum document_codec {
+	codec_none = 0,
+
+	// zlib stream (RFC 1950), it is the same thing HTTP calls 'deflate' content coding
+	codec_deflate = 1,
+};
+
+enum {
+	// bodies smaller than this are stored as is, compression does not pay off for them
+	codec_min_size = 512,
+
+	// deflate can not expand data more than 1032 times, stored size above that
+	// (or above the fixed limit) means record is corrupted
+	codec_max_ratio = 1032,
+	codec_max_size = 1024 * 1024 * 1024,
+};
+
+// returns codec document body of @size bytes is stored with
+static inline document_codec choose_codec(size_t size)
+{
+	return size >= codec_min_size ? codec_deflate : codec_none;
+}
+
+// encodes @size bytes at @data into @out, returns false if encoded data is not smaller,
+// body has to be stored with codec_none then
+bool encode(document_codec codec, const char *data, size_t size, std::string &out);
+
+// checks that @size bytes encoded with @codec can decode into @out_size bytes,
+// throws -EPROTO otherwise, it has to be called before buffer for decoded body is allocated
+void check_size(int codec, size_t size, size_t out_size);
+
+// decodes @size bytes at @data into @out which must be exactly @out_size bytes long,
+// throws -EPROTO if data is corrupted or codec is unknown
+void decode(int codec, const char *data, size_t size, char *out, size_t out_size);
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_CODEC_HPP */
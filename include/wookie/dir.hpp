@@ -34,7 +34,7 @@
 
 namespace ioremap { namespace wookie {
 
-	void iterate_directory(const std::string &base, const std::function<bool (const char *, const char *)> &fn) {
+	static inline void iterate_directory(const std::string &base, const std::function<bool (const char *, const char *)> &fn) {
 		int fd;
 		DIR *dir;
 		struct dirent64 *d;
@@ -33,15 +33,27 @@
 #include <ev++.h>
 
 #include <atomic>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <thread>
 
 #include <wookie/document.hpp>
+#include <wookie/frontier.hpp>
+#include <wookie/hash.hpp>
+#include <wookie/metrics.hpp>
+#include <wookie/reply_stream.hpp>
 
 namespace ioremap { namespace wookie {
 
 class downloader {
 	public:
-		downloader() :  m_swarm_loop(m_loop), m_async(m_loop), m_manager(m_swarm_loop, m_logger), m_thread(std::bind(&downloader::crawl, this)) {
+		downloader(long total_limit) :
+		m_swarm_loop(m_loop),
+		m_async(m_loop),
+		m_manager(m_swarm_loop, m_logger),
+		m_total_limit(total_limit),
+		m_thread(std::bind(&downloader::crawl, this)) {
 		}
 
 		~downloader() {
@@ -50,8 +62,8 @@ class downloader {
 		}
 
 		void enqueue(ioremap::swarm::url_fetcher::request &&request,
-				const ioremap::swarm::simple_stream::handler_func &handler) {
-			m_manager.get(std::make_shared<ioremap::swarm::simple_stream>(handler), std::move(request));
+				const std::shared_ptr<ioremap::swarm::base_stream> &stream) {
+			m_manager.get(stream, std::move(request));
 		}
 
 	private:
@@ -60,6 +72,7 @@ class downloader {
 		swarm::ev_event_loop m_swarm_loop;
 		ev::async m_async;
 		ioremap::swarm::url_fetcher m_manager;
+		long m_total_limit;
 		std::thread m_thread;
 
 		std::atomic_long m_counter, m_prev_counter;
@@ -70,7 +83,7 @@ class downloader {
 			m_async.set<downloader, &downloader::crawl_stop>(this);
 			m_async.start();
 
-			m_manager.set_total_limit(10); /* number of active connections */
+			m_manager.set_total_limit(m_total_limit); /* number of active connections */
 
 			m_loop.loop();
 		}
@@ -80,43 +93,254 @@ class downloader {
 		}
 };
 
+// Passes swarm reply into reply_stream chunk by chunk
+//
+// Body larger than @max_size (0 - unlimited) is not delivered: reply announced to be larger
+// is rejected when headers arrive, otherwise delivery stops at the first chunk over the limit,
+// in both cases stream is closed with 'file too large' error. @completion is called when
+// transfer is finished, before stream is closed.
+//
+// Swarm stream can not abort transfer, rejected body is still received and its connection
+// and host slot stay busy until swarm closes it, rejection only saves buffering and processing.
+class limited_stream : public ioremap::swarm::base_stream {
+	public:
+		typedef std::function<void (const boost::system::error_code &error)> completion_func;
+
+		limited_stream(const shared_reply_stream &stream, size_t max_size, const completion_func &completion) :
+		m_stream(stream),
+		m_max_size(max_size),
+		m_completion(completion),
+		m_size(0) {
+		}
+
+		virtual void on_headers(ioremap::swarm::url_fetcher::response &&reply) {
+			m_reply = std::move(reply);
+
+			if (m_max_size) {
+				auto size = m_reply.headers().content_length();
+				if (size && *size > m_max_size) {
+					reject(boost::system::errc::file_too_large);
+					return;
+				}
+			}
+
+			if (!m_stream->on_headers(m_reply))
+				reject(boost::system::errc::operation_canceled);
+		}
+
+		virtual void on_data(const boost::asio::const_buffer &buffer) {
+			if (m_error)
+				return;
+
+			const size_t size = boost::asio::buffer_size(buffer);
+			if (m_max_size && m_size + size > m_max_size) {
+				reject(boost::system::errc::file_too_large);
+				return;
+			}
+
+			m_size += size;
+			m_stream->on_data(boost::asio::buffer_cast<const char *>(buffer), size);
+		}
+
+		virtual void on_close(const boost::system::error_code &error) {
+			const boost::system::error_code &err = error ? error : m_error;
+
+			m_completion(err);
+			m_stream->on_close(m_reply, err);
+		}
+
+	private:
+		shared_reply_stream m_stream;
+		size_t m_max_size;
+		completion_func m_completion;
+
+		ioremap::swarm::url_fetcher::response m_reply;
+		size_t m_size;
+		boost::system::error_code m_error;
+
+		// remaining chunks are discarded, transfer itself goes on
+		void reject(boost::system::errc::errc_t err) {
+			m_error = boost::system::errc::make_error_code(err);
+		}
+};
+
+// Consistent hash ring which maps host names to downloaders
+//
+// Every downloader owns @replicas points on the ring, host belongs to the downloader
+// whose point follows host hash. All requests to the same host go through the same
+// curl multi handle, which allows to reuse keep-alive connections.
+class host_ring {
+	public:
+		host_ring(int nodes, int replicas = 64) {
+			for (int node = 0; node < nodes; ++node) {
+				for (int r = 0; r < replicas; ++r) {
+					std::ostringstream ss;
+					ss << node << "-" << r;
+
+					m_ring.insert(std::make_pair((uint64_t)hash::murmur(ss.str(), 0), node));
+				}
+			}
+		}
+
+		int node(const std::string &host) const {
+			auto it = m_ring.lower_bound(hash::murmur(host, 0));
+			if (it == m_ring.end())
+				it = m_ring.begin();
+
+			return it->second;
+		}
+
+	private:
+		std::map<uint64_t, int> m_ring;
+};
+
 class dmanager {
 	public:
-		dmanager(int tnum) : m_signal(m_loop), m_downloaders(tnum) {
+		// @tnum - number of downloader threads
+		// @total_limit - maximum number of active connections per downloader thread
+		// @host_limit - maximum number of active connections per host
+		// @max_body_size - maximum size of reply body, 0 means unlimited, see limited_stream
+		dmanager(int tnum, long total_limit, size_t frontier_size, int host_limit, long host_delay_ms,
+				size_t max_body_size = 0) :
+		m_signal(m_loop),
+		m_timer(m_loop),
+		m_frontier(frontier_size, tnum * total_limit, host_limit, host_delay_ms),
+		m_ring(tnum),
+		m_max_body_size(max_body_size),
+		m_download_time(NULL),
+		m_download_errors(NULL) {
+			for (int i = 0; i < tnum; ++i)
+				m_downloaders.emplace_back(new wookie::downloader(total_limit));
+
 			m_signal.set<dmanager, &dmanager::signal_received>(this);
 			m_signal.start(SIGTERM);
 
-			srand(time(NULL));
+			// wakes up hosts whose politeness delay has expired
+			m_timer.set<dmanager, &dmanager::timer_expired>(this);
+			m_timer.start(0.05, 0.05);
 		}
 
 		void start(void) {
 			m_loop.loop();
 		}
 
-		void feed(const swarm::url &url, const ioremap::swarm::simple_stream::handler_func &handler) {
-			ioremap::swarm::url_fetcher::request request;
-			request.set_follow_location(true);
-			request.set_url(url);
-			m_downloaders[rand() % m_downloaders.size()].enqueue(std::move(request), handler);
+		// returns false if frontier is full and request has been dropped
+		bool feed(const swarm::url &url, const shared_reply_stream &stream, int priority = 0, int depth = 0) {
+			frontier::item it;
+			it.request.set_follow_location(true);
+			it.request.set_url(url);
+			it.stream = stream;
+			it.priority = priority;
+			it.depth = depth;
+			it.ts = time(NULL);
+
+			return push(url, std::move(it));
+		}
+
+		bool feed(const swarm::url &url, const document &doc, const shared_reply_stream &stream,
+				int priority = 0, int depth = 0) {
+			frontier::item it;
+			it.request.set_follow_location(true);
+			it.request.set_url(url);
+			it.request.headers().set_if_modified_since(doc.ts.tsec);
+			it.stream = stream;
+			it.priority = priority;
+			it.depth = depth;
+			it.ts = doc.ts.tsec;
+
+			return push(url, std::move(it));
+		}
+
+		// whole body is buffered and passed to @handler
+		bool feed(const swarm::url &url, const ioremap::swarm::simple_stream::handler_func &handler,
+				int priority = 0, int depth = 0) {
+			return feed(url, make_buffered_stream(handler), priority, depth);
 		}
 
-		void feed(const swarm::url &url, const document &doc, const ioremap::swarm::simple_stream::handler_func &handler) {
-			ioremap::swarm::url_fetcher::request request;
-			request.set_follow_location(true);
-			request.set_url(url);
-			request.headers().set_if_modified_since(doc.ts.tsec);
+		bool feed(const swarm::url &url, const document &doc, const ioremap::swarm::simple_stream::handler_func &handler,
+				int priority = 0, int depth = 0) {
+			return feed(url, doc, make_buffered_stream(handler), priority, depth);
+		}
+
+		size_t queued() {
+			return m_frontier.size();
+		}
+
+		// number of downloads in progress
+		size_t active() {
+			return m_frontier.active();
+		}
+
+		// download time (including name resolution and connection setup) and
+		// download errors are recorded into @m
+		void set_metrics(wookie::metrics &m) {
+			m_download_time = &m.get_histogram("download_time");
+			m_download_errors = &m.get_counter("download_errors");
+		}
 
-			m_downloaders[rand() % m_downloaders.size()].enqueue(std::move(request), handler);
+		// while @check returns true no new downloads are started,
+		// it is used to pause fetching when document processing falls behind
+		void set_pause_check(const std::function<bool ()> &check) {
+			m_pause_check = check;
 		}
 
 	private:
 		ev::default_loop m_loop;
 		ev::sig m_signal;
-		std::vector<wookie::downloader>	m_downloaders;
+		ev::timer m_timer;
+		wookie::frontier m_frontier;
+		wookie::host_ring m_ring;
+		std::vector<std::unique_ptr<wookie::downloader>> m_downloaders;
+		std::function<bool ()> m_pause_check;
+		size_t m_max_body_size;
+
+		wookie::histogram *m_download_time;
+		wookie::counter *m_download_errors;
 
 		void signal_received(ev::sig &sig, int ) {
 			sig.loop.break_loop();
 		}
+
+		void timer_expired(ev::timer &, int) {
+			dispatch();
+		}
+
+		bool push(const swarm::url &url, frontier::item &&it) {
+			it.host = url.host();
+
+			if (!m_frontier.push(std::move(it)))
+				return false;
+
+			dispatch();
+			return true;
+		}
+
+		// starts as many queued requests as host and connection limits allow
+		void dispatch() {
+			if (m_pause_check && m_pause_check())
+				return;
+
+			std::vector<frontier::item> ready;
+			m_frontier.pop_ready(ready);
+
+			using namespace std::placeholders;
+			for (auto && it : ready) {
+				auto stream = std::make_shared<limited_stream>(it.stream, m_max_body_size,
+						std::bind(&dmanager::request_completed, this, it.host, wookie::timer(), _1));
+
+				m_downloaders[m_ring.node(it.host)]->enqueue(std::move(it.request), stream);
+			}
+		}
+
+		void request_completed(const std::string &host, const wookie::timer &started, const boost::system::error_code &error) {
+			if (m_download_time)
+				m_download_time->observe(started.elapsed_us());
+			if (error && m_download_errors)
+				m_download_errors->inc();
+
+			m_frontier.complete(host);
+			dispatch();
+		}
 };
 
 
@@ -17,6 +17,9 @@
 #ifndef __WOOKIE_DOCUMENT_HPP
 #define __WOOKIE_DOCUMENT_HPP
 
+#include "wookie/codec.hpp"
+
+#include <string.h>
 #include <time.h>
 
 #include <ostream>
@@ -28,6 +31,9 @@
 
 namespace ioremap { namespace wookie {
 
+// version 1 is packed as [1, ts, key, data], it is still read
+// version 2 is packed as [2, ts, key, codec, size, data], where @data is encoded with
+// codec (see wookie/codec.hpp) and decodes into @size bytes
 struct document {
 	dnet_time			ts;
 
@@ -35,7 +41,8 @@ struct document {
 	std::string			data;
 
 	enum {
-		version = 1,
+		version = 2,
+		version_raw = 1,
 	};
 
 	document() {
@@ -43,6 +50,130 @@ struct document {
 	}
 };
 
+// document prepared for storage, its body is encoded with codec chosen by body size
+// @doc - document whose timestamp and key are packed, its body is packed as is for codec_none
+// @body - encoded body
+struct encoded_document {
+	const document			&doc;
+
+	document_codec			codec;
+	std::string			body;
+
+	explicit encoded_document(const document &doc) : doc(doc), codec(choose_codec(doc.data.size())) {
+		if (codec != codec_none && !encode(codec, doc.data.data(), doc.data.size(), body))
+			codec = codec_none;
+	}
+};
+
+// alias is stored instead of document body when content is already stored
+// under another key, @target is the key of that document
+//
+// alias without target is a negative entry: URL was rejected by header filters
+// at @ts and there is no document for it
+struct document_alias {
+	dnet_time			ts;
+
+	std::string			target;
+
+	enum {
+		version = 1,
+	};
+
+	document_alias() {
+		dnet_current_time(&ts);
+	}
+
+	bool rejected() const {
+		return target.empty();
+	}
+};
+
+// small record stored next to every document and alias in its own namespace,
+// freshness checks read it instead of the document
+// @ts - time document or alias was stored
+// @size - size of document body
+// @content_hash - hash of document body, see recrawl_policy::content_hash()
+// @etag - ETag of the reply document was taken from, empty if server did not send it
+// @status - HTTP status of that reply
+// @alias - alias is stored under the key, @target is its target (empty for rejected URL)
+// @duplicate - alias points to near duplicate content instead of redirect target,
+//	such URL is refetched by the usual freshness rules
+struct document_meta {
+	dnet_time			ts;
+
+	uint64_t			size;
+	uint64_t			content_hash;
+	std::string			etag;
+	int				status;
+
+	bool				alias;
+	bool				duplicate;
+	std::string			target;
+
+	enum {
+		version = 2,
+	};
+
+	document_meta() : size(0), content_hash(0), status(0), alias(false), duplicate(false) {
+		dnet_current_time(&ts);
+	}
+
+	document_alias to_alias() const {
+		document_alias a;
+		a.ts = ts;
+		a.target = target;
+		return a;
+	}
+};
+
+// document unpacked without copying its key and body: @key and @data reference
+// the buffer document has been read into and keep it alive
+// @codec - encoding of @data, body is decoded only when it is asked for
+// @size - size of decoded body
+struct document_view {
+	dnet_time			ts;
+
+	elliptics::data_pointer		key;
+
+	int				codec;
+	uint64_t			size;
+	elliptics::data_pointer		data;
+
+	document_view() : codec(codec_none), size(0) {
+		memset(&ts, 0, sizeof(ts));
+	}
+
+	std::string key_string() const {
+		return std::string(key.data<char>(), key.size());
+	}
+
+	// body stored as is is returned without copying
+	elliptics::data_pointer body() const {
+		if (codec == codec_none)
+			return data;
+
+		elliptics::data_pointer ret = elliptics::data_pointer::allocate(size);
+		decode(codec, data.data<char>(), data.size(), ret.data<char>(), size);
+		return ret;
+	}
+
+	// decodes body straight into the string
+	std::string body_string() const {
+		std::string ret(size, '\0');
+		decode(codec, data.data<char>(), data.size(), &ret[0], size);
+		return ret;
+	}
+
+	// copies key and body out of the read buffer
+	document to_document() const {
+		document doc;
+		doc.ts = ts;
+		doc.key = key_string();
+		doc.data = body_string();
+		return doc;
+	}
+};
+
 }}
 
 namespace msgpack
@@ -71,40 +202,167 @@ inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const dn
 }
 #endif
 
+// version 1 document is a 4-element array, version 2 one is a 6-element array
 static inline ioremap::wookie::document &operator >>(msgpack::object o, ioremap::wookie::document &d)
 {
-	if (o.type != msgpack::type::ARRAY || o.via.array.size != 4)
-		ioremap::elliptics::throw_error(-EPROTO, "msgpack: document array size mismatch: compiled: %d, unpacked: %d",
-				4, o.via.array.size);
+	if (o.type != msgpack::type::ARRAY || (o.via.array.size != 4 && o.via.array.size != 6))
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: document array size mismatch: compiled: %d or %d, unpacked: %d",
+				4, 6, o.type == msgpack::type::ARRAY ? o.via.array.size : 0);
 
 	object *p = o.via.array.ptr;
 
+	const int expected = o.via.array.size == 4 ?
+		ioremap::wookie::document::version_raw : ioremap::wookie::document::version;
+
 	int version;
 	p[0].convert(&version);
 
-	if (version != ioremap::wookie::document::version)
+	if (version != expected)
 		ioremap::elliptics::throw_error(-EPROTO, "msgpack: document version mismatch: compiled: %d, unpacked: %d",
-				ioremap::wookie::document::version, version);
+				expected, version);
 
 	p[1].convert(&d.ts);
 	p[2].convert(&d.key);
-	p[3].convert(&d.data);
+
+	if (version == ioremap::wookie::document::version_raw) {
+		p[3].convert(&d.data);
+		return d;
+	}
+
+	int codec;
+	uint64_t size;
+	p[3].convert(&codec);
+	p[4].convert(&size);
+
+	if (p[5].type != msgpack::type::RAW)
+		throw msgpack::type_error();
+
+	// stored size is not trusted until it is checked against encoded body
+	ioremap::wookie::check_size(codec, p[5].via.raw.size, size);
+
+	d.data.resize(size);
+	ioremap::wookie::decode(codec, p[5].via.raw.ptr, p[5].via.raw.size, &d.data[0], size);
 
 	return d;
 }
 
+template <typename Stream>
+static inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const ioremap::wookie::encoded_document &e)
+{
+	const std::string &body = e.codec == ioremap::wookie::codec_none ? e.doc.data : e.body;
+
+	o.pack_array(6);
+	o.pack(static_cast<int>(ioremap::wookie::document::version));
+	o.pack(e.doc.ts);
+	o.pack(e.doc.key);
+	o.pack(static_cast<int>(e.codec));
+	o.pack(static_cast<uint64_t>(e.doc.data.size()));
+	o.pack(body);
+
+	return o;
+}
+
+// document is packed with its body as is, storage encodes it with encoded_document
 template <typename Stream>
 static inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const ioremap::wookie::document &d)
 {
-	o.pack_array(4);
+	o.pack_array(6);
 	o.pack(static_cast<int>(ioremap::wookie::document::version));
 	o.pack(d.ts);
 	o.pack(d.key);
+	o.pack(static_cast<int>(ioremap::wookie::codec_none));
+	o.pack(static_cast<uint64_t>(d.data.size()));
 	o.pack(d.data);
 
 	return o;
 }
 
+// alias is packed into 3-element array, which distinguishes it from document
+static inline ioremap::wookie::document_alias &operator >>(msgpack::object o, ioremap::wookie::document_alias &a)
+{
+	if (o.type != msgpack::type::ARRAY || o.via.array.size != 3)
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: document alias array size mismatch: compiled: %d, unpacked: %d",
+				3, o.via.array.size);
+
+	object *p = o.via.array.ptr;
+
+	int version;
+	p[0].convert(&version);
+
+	if (version != ioremap::wookie::document_alias::version)
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: document alias version mismatch: compiled: %d, unpacked: %d",
+				ioremap::wookie::document_alias::version, version);
+
+	p[1].convert(&a.ts);
+	p[2].convert(&a.target);
+
+	return a;
+}
+
+template <typename Stream>
+static inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const ioremap::wookie::document_alias &a)
+{
+	o.pack_array(3);
+	o.pack(static_cast<int>(ioremap::wookie::document_alias::version));
+	o.pack(a.ts);
+	o.pack(a.target);
+
+	return o;
+}
+
+static inline ioremap::wookie::document_meta &operator >>(msgpack::object o, ioremap::wookie::document_meta &m)
+{
+	if (o.type != msgpack::type::ARRAY || o.via.array.size < 1)
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: document meta is not an array");
+
+	object *p = o.via.array.ptr;
+
+	int version;
+	p[0].convert(&version);
+
+	// version 1 has no @duplicate field, all its aliases are redirects
+	const uint32_t size = version == 1 ? 8 : 9;
+
+	if (version != 1 && version != ioremap::wookie::document_meta::version)
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: document meta version mismatch: compiled: %d, unpacked: %d",
+				ioremap::wookie::document_meta::version, version);
+
+	if (o.via.array.size != size)
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: document meta array size mismatch: compiled: %d, unpacked: %d",
+				size, o.via.array.size);
+
+	p[1].convert(&m.ts);
+	p[2].convert(&m.size);
+	p[3].convert(&m.content_hash);
+	p[4].convert(&m.etag);
+	p[5].convert(&m.status);
+	p[6].convert(&m.alias);
+	p[7].convert(&m.target);
+
+	m.duplicate = false;
+	if (version > 1)
+		p[8].convert(&m.duplicate);
+
+	return m;
+}
+
+template <typename Stream>
+static inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const ioremap::wookie::document_meta &m)
+{
+	o.pack_array(9);
+	o.pack(static_cast<int>(ioremap::wookie::document_meta::version));
+	o.pack(m.ts);
+	o.pack(m.size);
+	o.pack(m.content_hash);
+	o.pack(m.etag);
+	o.pack(m.status);
+	o.pack(m.alias);
+	o.pack(m.target);
+	o.pack(m.duplicate);
+
+	return o;
+}
+
 } /* namespace msgpack */
 
 static inline std::ostream &operator <<(std::ostream &out, const ioremap::wookie::document &d)
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_DOCUMENT_CONTEXT_HPP
+#define __WOOKIE_DOCUMENT_CONTEXT_HPP
+
+#include <swarm/urlfetcher/url_fetcher.hpp>
+
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace ioremap { namespace wookie {
+
+class parser;
+
+// Downloaded document shared by all parsers, filters and processors of one reply
+//
+// HTML is parsed at most once, the first time links, text or tokens are requested,
+// and results are cached for every subsequent user. Context may be used from
+// different threads, lazy parsing is serialized.
+class document_context {
+	public:
+		document_context(const swarm::url_fetcher::response &reply, std::string &&data);
+		~document_context();
+
+		document_context(const document_context &) = delete;
+		document_context &operator =(const document_context &) = delete;
+
+		const swarm::url_fetcher::response &reply() const;
+		const std::string &data() const;
+
+		// lowercase charset from Content-Type header or, if it has none, from <meta> charset
+		// declaration, empty if neither is present
+		const std::string &charset();
+
+		// links found in <a href> tags
+		const std::vector<std::string> &urls();
+
+		// text blocks found in document
+		const std::vector<std::string> &tokens();
+
+		// text blocks joined by space
+		const std::string &text();
+
+		// lowercase words of the document text
+		const std::vector<std::string> &words();
+
+		// parser fed with this document, it throws if document could not be parsed
+		wookie::parser &parser();
+
+		// time spent parsing HTML in microseconds, 0 if document has not been parsed
+		int64_t parse_time() const;
+
+	private:
+		swarm::url_fetcher::response m_reply;
+		std::string m_data;
+
+		std::mutex m_lock;
+
+		bool m_parsed;
+		std::exception_ptr m_parse_error;
+		std::unique_ptr<wookie::parser> m_parser;
+		int64_t m_parse_time;
+
+		bool m_charset_ready;
+		std::string m_charset;
+
+		bool m_text_ready;
+		std::string m_text;
+
+		bool m_words_ready;
+		std::vector<std::string> m_words;
+
+		// must be called with @m_lock held
+		wookie::parser &parse();
+};
+
+typedef std::shared_ptr<document_context> shared_document_context;
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_DOCUMENT_CONTEXT_HPP */
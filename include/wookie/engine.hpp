@@ -21,10 +21,13 @@
 #include <boost/program_options.hpp>
 
 #include <wookie/document.hpp>
+#include <wookie/document_context.hpp>
+#include <wookie/url_filter.hpp>
 
 namespace ioremap { namespace wookie {
 
 class engine_data;
+class metrics;
 class storage;
 
 enum document_type
@@ -34,12 +37,16 @@ enum document_type
 	document_update
 };
 
-typedef std::function<std::vector<std::string> (const swarm::url_fetcher::response &reply, const std::string &)> parser_functor;
-typedef std::function<bool (const swarm::url_fetcher::response &reply, const std::string &)> filter_functor;
+typedef std::function<std::vector<std::string> (document_context &ctx)> parser_functor;
+typedef std::function<bool (document_context &ctx)> filter_functor;
+typedef std::function<bool (const swarm::url_fetcher::response &reply)> header_filter_functor;
 typedef std::function<bool (const swarm::url_fetcher::response &reply, const swarm::url &url)> url_filter_functor;
-typedef std::function<void (const swarm::url_fetcher::response &reply, const std::string &, document_type type)> process_functor;
+typedef std::function<void (document_context &ctx, document_type type)> process_functor;
 
 filter_functor create_text_filter();
+// accepts replies with text/* or without Content-Type and with Content-Length not larger
+// than @max_content_length (0 means any)
+header_filter_functor create_text_header_filter(size_t max_content_length = 0);
 url_filter_functor create_domain_filter(const std::string &url);
 url_filter_functor create_port_filter(const std::vector<int> &ports);
 parser_functor create_href_parser();
@@ -55,11 +62,18 @@ public:
 
 	storage *get_storage();
 
+	// crawler metrics registry, processors may add their own counters and histograms
+	metrics &get_metrics();
+
 	void add_options(const boost::program_options::options_description &description);
 	boost::program_options::options_description_easy_init add_options(const std::string &name);
 
 	void add_parser(const parser_functor &parser);
 	void add_filter(const filter_functor &filter);
+	// header filters are checked when reply headers arrive, body of rejected reply is neither buffered nor processed
+	void add_header_filter(const header_filter_functor &filter);
+	// links are checked by compiled filter first, then by every functor added with add_url_filter()
+	void set_url_filter(const url_filter_spec &spec);
 	void add_url_filter(const url_filter_functor &filter);
 	void add_processor(const process_functor &process);
 	void add_fallback_processor(const process_functor &process);
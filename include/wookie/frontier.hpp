@@ -0,0 +1,221 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_FRONTIER_HPP
+#define __WOOKIE_FRONTIER_HPP
+
+#include "wookie/reply_stream.hpp"
+
+#include <swarm/urlfetcher/url_fetcher.hpp>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace ioremap { namespace wookie {
+
+// Crawl frontier: requests waiting to be downloaded
+//
+// Requests are grouped into per-host queues ordered by caller-supplied priority
+// (higher first), link depth (smaller first), freshness (older timestamp first) and
+// arrival order. Hosts which may start new request are kept in global priority heap
+// keyed by their best queued request.
+//
+// Every host may have at most @host_limit active requests and new request
+// to the same host is not started earlier than @host_delay after previous one.
+// Total number of active requests is limited by @total_limit, total number of queued
+// requests is limited by @max_size.
+class frontier {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		struct item {
+			std::string host;
+			swarm::url_fetcher::request request;
+			shared_reply_stream stream;
+
+			int priority;
+			int depth;
+			uint64_t ts;
+
+			item() : priority(0), depth(0), ts(0) {}
+		};
+
+		frontier(size_t max_size, int total_limit, int host_limit, long host_delay_ms) :
+		m_max_size(max_size),
+		m_total_limit(total_limit),
+		m_host_limit(host_limit),
+		m_host_delay(std::chrono::milliseconds(host_delay_ms)),
+		m_size(0), m_active(0), m_seq(0) {
+		}
+
+		// returns false if frontier is full and request has been dropped
+		bool push(item &&it) {
+			std::unique_lock<std::mutex> guard(m_lock);
+
+			if (m_size >= m_max_size)
+				return false;
+
+			host &h = m_hosts[it.host];
+			const key k(-it.priority, it.depth, it.ts, m_seq++);
+			const std::string name = it.host;
+
+			h.queue.insert(std::make_pair(k, std::move(it)));
+			++m_size;
+
+			schedule(name, h, clock::now());
+			return true;
+		}
+
+		// moves requests which can be started right now into @ready
+		// and accounts them as active
+		void pop_ready(std::vector<item> &ready) {
+			std::unique_lock<std::mutex> guard(m_lock);
+
+			const clock::time_point now = clock::now();
+
+			while (!m_delayed.empty() && m_delayed.begin()->first <= now) {
+				const std::string name = m_delayed.begin()->second;
+				m_delayed.erase(m_delayed.begin());
+
+				auto hit = m_hosts.find(name);
+				if (hit != m_hosts.end()) {
+					hit->second.scheduled = false;
+					schedule(name, hit->second, now);
+				}
+			}
+
+			while (m_active < m_total_limit && !m_ready.empty()) {
+				const std::string name = m_ready.top().second;
+				m_ready.pop();
+
+				auto hit = m_hosts.find(name);
+				if (hit == m_hosts.end())
+					continue;
+
+				host &h = hit->second;
+				h.scheduled = false;
+
+				if (h.queue.empty()) {
+					if (!h.active)
+						m_hosts.erase(hit);
+					continue;
+				}
+
+				if (h.active >= m_host_limit)
+					continue;
+
+				auto qit = h.queue.begin();
+				ready.emplace_back(std::move(qit->second));
+				h.queue.erase(qit);
+
+				--m_size;
+				++m_active;
+				++h.active;
+				h.next_start = now + m_host_delay;
+
+				schedule(name, h, now);
+			}
+		}
+
+		// must be called when request started by pop_ready() has been completed
+		void complete(const std::string &name) {
+			std::unique_lock<std::mutex> guard(m_lock);
+
+			--m_active;
+
+			auto hit = m_hosts.find(name);
+			if (hit == m_hosts.end())
+				return;
+
+			host &h = hit->second;
+			--h.active;
+
+			if (h.queue.empty() && !h.active && !h.scheduled) {
+				m_hosts.erase(hit);
+				return;
+			}
+
+			schedule(name, h, clock::now());
+		}
+
+		size_t size() {
+			std::unique_lock<std::mutex> guard(m_lock);
+			return m_size;
+		}
+
+		int active() {
+			std::unique_lock<std::mutex> guard(m_lock);
+			return m_active;
+		}
+
+	private:
+		// -priority, depth, timestamp, sequence number
+		typedef std::tuple<int, int, uint64_t, uint64_t> key;
+
+		struct host {
+			std::multimap<key, item> queue;
+			int active;
+			bool scheduled;
+			clock::time_point next_start;
+
+			host() : active(0), scheduled(false) {}
+		};
+
+		struct ready_compare {
+			bool operator() (const std::pair<key, std::string> &a, const std::pair<key, std::string> &b) const {
+				return a.first > b.first;
+			}
+		};
+
+		size_t m_max_size;
+		int m_total_limit;
+		int m_host_limit;
+		clock::duration m_host_delay;
+
+		std::mutex m_lock;
+		size_t m_size;
+		int m_active;
+		uint64_t m_seq;
+
+		std::unordered_map<std::string, host> m_hosts;
+		std::priority_queue<std::pair<key, std::string>, std::vector<std::pair<key, std::string>>, ready_compare> m_ready;
+		std::multimap<clock::time_point, std::string> m_delayed;
+
+		// puts host either into ready heap or into delayed set if it has queued requests
+		// and is allowed to start one more, host is never scheduled twice
+		void schedule(const std::string &name, host &h, const clock::time_point &now) {
+			if (h.scheduled || h.queue.empty() || h.active >= m_host_limit)
+				return;
+
+			h.scheduled = true;
+
+			if (h.next_start > now) {
+				m_delayed.insert(std::make_pair(h.next_start, name));
+			} else {
+				m_ready.push(std::make_pair(h.queue.begin()->first, name));
+			}
+		}
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_FRONTIER_HPP */
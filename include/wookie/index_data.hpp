@@ -18,6 +18,7 @@
 #define __INDEX_DATA_HPP
 
 #include "wookie/document.hpp"
+#include "wookie/varint.hpp"
 
 #include "elliptics/session.hpp"
 #include "elliptics/debug.hpp"
@@ -26,12 +27,19 @@
 
 #include <msgpack.hpp>
 
+#include <algorithm>
+
 namespace ioremap { namespace wookie {
 
 // index_data class stores additional info for every object (downloaded document) tagged by given index
 // @ts - document download/index update time
-// @key - index token name - it is stored in elliptics as 64-bit ID, this field allows to grab the name
+// @key - index token name - it is stored in elliptics as 64-bit ID, this field allows to grab the name,
+//	it is only present in version 2 postings, version 3 does not store it
 // @pos - array of token positions where given index token was found
+//
+// version 2 posting is packed as [2, ts, pos array, key]
+// version 3 posting is packed as [3, ts seconds, positions], where positions are sorted
+// and stored as a raw string of varint-encoded deltas, see wookie/varint.hpp
 struct index_data {
 	dnet_time ts;
 	std::string key;
@@ -57,7 +65,8 @@ struct index_data {
 	}
 
 	enum {
-		version = 2,
+		version = 3,
+		version_v2 = 2,
 	};
 };
 
@@ -75,22 +84,52 @@ inline std::ostream &operator <<(std::ostream &out, const ioremap::wookie::index
 namespace msgpack {
 static inline ioremap::wookie::index_data &operator >>(msgpack::object o, ioremap::wookie::index_data &d)
 {
-	if (o.type != msgpack::type::ARRAY || o.via.array.size != 4)
-		ioremap::elliptics::throw_error(-EPROTO, "msgpack: index data array size mismatch: compiled: %d, unpacked: %d",
-				3, o.via.array.size);
+	if (o.type != msgpack::type::ARRAY || (o.via.array.size != 3 && o.via.array.size != 4))
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: index data array size mismatch: compiled: %d or %d, unpacked: %d",
+				3, 4, o.type == msgpack::type::ARRAY ? o.via.array.size : 0);
 
 	object *p = o.via.array.ptr;
 
+	const int expected = o.via.array.size == 4 ?
+		ioremap::wookie::index_data::version_v2 : ioremap::wookie::index_data::version;
+
 	int version;
 	p[0].convert(&version);
 
-	if (version != ioremap::wookie::index_data::version)
+	if (version != expected)
 		ioremap::elliptics::throw_error(-EPROTO, "msgpack: index data version mismatch: compiled: %d, unpacked: %d",
-				ioremap::wookie::index_data::version, version);
+				expected, version);
+
+	// postings written before version 3 are still read, they are rewritten when document is indexed again
+	if (version == ioremap::wookie::index_data::version_v2) {
+		p[1].convert(&d.ts);
+		p[2].convert(&d.pos);
+		p[3].convert(&d.key);
+
+		return d;
+	}
+
+	d.ts.tnsec = 0;
+	p[1].convert(&d.ts.tsec);
+
+	if (p[2].type != msgpack::type::RAW)
+		throw msgpack::type_error();
+
+	const char *data = p[2].via.raw.ptr;
+	const char *end = data + p[2].via.raw.size;
 
-	p[1].convert(&d.ts);
-	p[2].convert(&d.pos);
-	p[3].convert(&d.key);
+	d.key.clear();
+	d.pos.clear();
+
+	uint64_t position = 0;
+	while (data < end) {
+		uint64_t delta;
+		if (!ioremap::wookie::varint::read(data, end, delta))
+			ioremap::elliptics::throw_error(-EPROTO, "msgpack: index data positions are truncated");
+
+		position += delta;
+		d.pos.push_back((int)position);
+	}
 
 	return d;
 }
@@ -98,11 +137,25 @@ static inline ioremap::wookie::index_data &operator >>(msgpack::object o, iorema
 template <typename Stream>
 inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const ioremap::wookie::index_data &d)
 {
-	o.pack_array(4);
+	std::vector<int> pos(d.pos);
+	std::sort(pos.begin(), pos.end());
+
+	std::string deltas;
+	deltas.reserve(pos.size() * 2);
+
+	int prev = 0;
+	for (auto p : pos) {
+		if (p < 0)
+			ioremap::elliptics::throw_error(-EINVAL, "msgpack: index data: negative position %d", p);
+
+		ioremap::wookie::varint::append(deltas, p - prev);
+		prev = p;
+	}
+
+	o.pack_array(3);
 	o.pack(static_cast<int>(ioremap::wookie::index_data::version));
-	o.pack(d.ts);
-	o.pack(d.pos);
-	o.pack(d.key);
+	o.pack(d.ts.tsec);
+	o.pack(deltas);
 
 	return o;
 }
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_INDEX_WRITER_HPP
+#define __WOOKIE_INDEX_WRITER_HPP
+
+#include <elliptics/session.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ioremap { namespace wookie {
+
+class storage;
+
+// Group commit of secondary index updates
+//
+// Index updates of many documents are collected and written as one batch when either
+// @max_documents of them are queued or the oldest one has waited for @max_delay_ms.
+// Tokens are merged over the whole batch: every distinct token is transformed once,
+// term dictionary is updated once and backend gets all documents in a single
+// bulk_set_indexes() call. Only one batch is written at a time, add() blocks when
+// @max_pending documents are waiting for it.
+//
+// Every document keeps its own completion handler, it is called from writer thread
+// and must not call add() itself.
+class index_writer {
+	public:
+		enum {
+			default_max_documents = 128,
+			default_max_delay_ms = 5,
+		};
+
+		typedef std::function<void (const elliptics::error_info &error)> completion_handler;
+
+		explicit index_writer(storage &st);
+		// writes everything which has been queued
+		~index_writer();
+
+		index_writer(const index_writer &) = delete;
+		index_writer &operator =(const index_writer &) = delete;
+
+		void set_limits(size_t max_documents, long max_delay_ms);
+
+		// queues update which replaces all indexes of document @key with @indexes tagged with @datas,
+		// @handler may be empty
+		void add(const std::string &key, const std::vector<std::string> &indexes,
+				const std::vector<elliptics::data_pointer> &datas, const completion_handler &handler);
+
+		// writes everything queued so far and waits for it
+		void flush();
+
+	private:
+		struct update {
+			std::string key;
+			std::vector<std::string> indexes;
+			std::vector<elliptics::data_pointer> datas;
+			completion_handler handler;
+		};
+
+		storage &m_st;
+
+		std::mutex m_lock;
+		std::condition_variable m_cond;
+		std::condition_variable m_written_cond;
+
+		size_t m_max_documents;
+		size_t m_max_pending;
+		std::chrono::milliseconds m_max_delay;
+
+		std::vector<update> m_pending;
+		std::chrono::steady_clock::time_point m_oldest;
+
+		// number of documents ever queued and written, flush() waits for the latter
+		// to reach @m_flush_target
+		uint64_t m_queued;
+		uint64_t m_written;
+		uint64_t m_flush_target;
+
+		bool m_stop;
+		std::thread m_thread;
+
+		void run();
+		void write(std::vector<update> &batch);
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_INDEX_WRITER_HPP */
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_INFLIGHT_HPP
+#define __WOOKIE_INFLIGHT_HPP
+
+#include "wookie/document.hpp"
+#include "wookie/hash.hpp"
+#include "wookie/recrawl.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+namespace ioremap { namespace wookie {
+
+// Set of URLs which are currently being downloaded
+//
+// URLs are keyed by 64-bit fingerprint and spread over independently locked shards,
+// so downloader threads rarely contend on the same lock.
+// Only metadata needed to handle '304 Not Modified' reply is kept for page cache refetches,
+// document body is read from storage again when server says it has not been changed.
+class inflight_registry {
+	public:
+		// @ts - timestamp of the cached document, used for If-Modified-Since header
+		// @key - storage key of the cached document, empty if URL was not found in page cache
+		// @recrawl - change history of the URL, empty if it has never been fetched
+		struct entry {
+			dnet_time ts;
+			std::string key;
+			recrawl_state recrawl;
+
+			entry() {
+				memset(&ts, 0, sizeof(ts));
+			}
+
+			bool cached() const {
+				return !key.empty();
+			}
+		};
+
+		explicit inflight_registry(size_t shards_num = 64) : m_shards(shards_num), m_size(0) {
+		}
+
+		static uint64_t fingerprint(const std::string &url) {
+			return hash::murmur(url, 0);
+		}
+
+		// returns false if URL is already in flight
+		bool insert(const std::string &url) {
+			return insert(fingerprint(url));
+		}
+
+		bool insert(const std::string &url, const document &doc, const recrawl_state &recrawl = recrawl_state()) {
+			return insert(fingerprint(url), doc, recrawl);
+		}
+
+		// removes URL from the registry, returns false if it was not there
+		bool erase(const std::string &url, entry &e) {
+			return erase(fingerprint(url), e);
+		}
+
+		// @id - URL fingerprint as assigned by url_table
+		bool insert(uint64_t id) {
+			return insert_entry(id, entry());
+		}
+
+		bool insert(uint64_t id, const document &doc, const recrawl_state &recrawl = recrawl_state()) {
+			entry e;
+			e.ts = doc.ts;
+			e.key = doc.key;
+			e.recrawl = recrawl;
+
+			return insert_entry(id, std::move(e));
+		}
+
+		// stores page cache metadata of URL which has already been claimed by insert(@id),
+		// URL is inserted if it is not in flight yet
+		void update(uint64_t id, const document &doc, const recrawl_state &recrawl = recrawl_state()) {
+			entry e;
+			e.ts = doc.ts;
+			e.key = doc.key;
+			e.recrawl = recrawl;
+
+			shard &sh = get_shard(id);
+
+			std::unique_lock<std::mutex> guard(sh.lock);
+			auto ret = sh.entries.insert(std::make_pair(id, entry()));
+			if (ret.second)
+				++m_size;
+
+			ret.first->second = std::move(e);
+		}
+
+		bool erase(uint64_t id, entry &e) {
+			shard &sh = get_shard(id);
+
+			std::unique_lock<std::mutex> guard(sh.lock);
+			auto it = sh.entries.find(id);
+			if (it == sh.entries.end())
+				return false;
+
+			e = std::move(it->second);
+			sh.entries.erase(it);
+			--m_size;
+
+			return true;
+		}
+
+		size_t size() const {
+			return m_size;
+		}
+
+	private:
+		struct shard {
+			std::mutex lock;
+			std::unordered_map<uint64_t, entry> entries;
+		};
+
+		std::vector<shard> m_shards;
+		std::atomic_long m_size;
+
+		shard &get_shard(uint64_t id) {
+			return m_shards[id % m_shards.size()];
+		}
+
+		bool insert_entry(uint64_t id, entry &&e) {
+			shard &sh = get_shard(id);
+
+			std::unique_lock<std::mutex> guard(sh.lock);
+			if (!sh.entries.insert(std::make_pair(id, std::move(e))).second)
+				return false;
+
+			++m_size;
+			return true;
+		}
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_INFLIGHT_HPP */
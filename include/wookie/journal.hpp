@@ -0,0 +1,97 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_JOURNAL_HPP
+#define __WOOKIE_JOURNAL_HPP
+
+#include <elliptics/packet.h>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <stdint.h>
+
+namespace ioremap { namespace wookie {
+
+// Append-only crawl journal
+//
+// Journal records crawl generation time, every URL accepted for crawling (frontier and
+// in-flight URLs) and every URL whose processing has been completed. When crawler
+// restarts with the same journal, generation time is restored and URLs which were
+// accepted but not completed are reported by recover(), so crawl continues where it stopped.
+//
+// Record format: 1-byte type, 4-byte payload size, payload.
+// Torn record at the end of journal (crash in the middle of write) is discarded.
+//
+// Only fingerprints of pending URLs are kept in memory, journal is compacted
+// (rewritten with pending URLs only) when completed records dominate it.
+class journal {
+	public:
+		// opens or creates journal at @path and replays it
+		explicit journal(const std::string &path);
+		~journal();
+
+		journal(const journal &) = delete;
+		journal &operator =(const journal &) = delete;
+
+		// returns false if journal did not contain generation time
+		bool generation(dnet_time &ts) const;
+		void set_generation(const dnet_time &ts);
+
+		// calls @fn for every URL found in journal, @pending is true for URLs which
+		// were accepted but not completed before restart
+		void recover(const std::function<void (const std::string &url, bool pending)> &fn);
+
+		void add(const std::string &url);
+		void done(const std::string &url);
+
+		// @fp - fingerprint of @url as assigned by url_table, it is not computed again
+		void add(uint64_t fp, const std::string &url);
+		void done(uint64_t fp);
+
+	private:
+		enum record_type {
+			record_generation = 'G',
+			record_add = 'A',
+			record_done = 'D',
+		};
+
+		std::string m_path;
+		int m_fd;
+
+		std::mutex m_lock;
+
+		bool m_has_generation;
+		dnet_time m_generation;
+
+		std::unordered_set<uint64_t> m_pending;
+		size_t m_records;
+
+		// replays journal via mmap, calls @fn for every complete record and
+		// returns size of the valid part of the journal
+		size_t replay(const std::string &path,
+				const std::function<void (char type, const char *payload, uint32_t size)> &fn);
+
+		void append(int fd, char type, const void *payload, uint32_t size);
+		void compact();
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_JOURNAL_HPP */
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_LOG_HPP
+#define __WOOKIE_LOG_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+
+namespace ioremap { namespace wookie {
+
+enum log_level {
+	log_error = 0,
+	log_info,
+	log_debug,
+};
+
+// Asynchronous logger
+//
+// Every thread writes messages into its own single-producer ring buffer without locks,
+// background thread drains all rings and writes messages to the output file.
+// Logging thread never waits for output: if its ring is full message is dropped and counted.
+//
+// Use WOOKIE_LOG() macro, message is not even formatted when its level is disabled.
+class logger {
+	public:
+		static logger &instance();
+
+		static bool enabled(int level) {
+			return level <= m_level.load(std::memory_order_relaxed);
+		}
+
+		static void set_level(int level) {
+			m_level = level;
+		}
+
+		// switches output to @path, "/dev/stdout" is used by default
+		void set_output(const std::string &path);
+
+		void write(int level, std::string &&msg);
+
+		// number of messages dropped because of full ring buffers
+		long dropped() const {
+			return m_dropped;
+		}
+
+		~logger();
+
+	private:
+		class ring;
+
+		static std::atomic_int m_level;
+
+		std::mutex m_lock;
+		std::vector<std::shared_ptr<ring>> m_rings;
+
+		std::mutex m_output_lock;
+		FILE *m_output;
+
+		std::atomic_long m_dropped;
+		std::atomic_bool m_stop;
+		std::thread m_thread;
+
+		logger();
+
+		ring &thread_ring();
+		void run();
+		bool drain();
+};
+
+}} // namespace ioremap::wookie
+
+#define WOOKIE_LOG(level, message) \
+	do { \
+		if (::ioremap::wookie::logger::enabled(::ioremap::wookie::level)) { \
+			std::ostringstream __wookie_log_ss; \
+			__wookie_log_ss << message; \
+			::ioremap::wookie::logger::instance().write(::ioremap::wookie::level, __wookie_log_ss.str()); \
+		} \
+	} while (0)
+
+#endif /* __WOOKIE_LOG_HPP */
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_METRICS_HPP
+#define __WOOKIE_METRICS_HPP
+
+#include "wookie/timer.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <stdint.h>
+
+namespace ioremap { namespace wookie {
+
+class counter {
+	public:
+		counter() : m_value(0) {}
+
+		void inc(long n = 1) {
+			m_value.fetch_add(n, std::memory_order_relaxed);
+		}
+
+		long value() const {
+			return m_value.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic_long m_value;
+};
+
+// Latency histogram with fixed buckets, values are microseconds
+class histogram {
+	public:
+		enum {
+			buckets = 19,
+		};
+
+		histogram() : m_count(0), m_sum(0) {
+			for (auto && b : m_buckets)
+				b = 0;
+		}
+
+		// upper bound of bucket @idx in microseconds, the last bucket is unbounded
+		static int64_t bound(int idx) {
+			static const int64_t bounds[buckets] = {
+				100, 250, 500,
+				1000, 2500, 5000,
+				10000, 25000, 50000,
+				100000, 250000, 500000,
+				1000000, 2500000, 5000000,
+				10000000, 30000000, 60000000,
+				std::numeric_limits<int64_t>::max(),
+			};
+
+			return bounds[idx];
+		}
+
+		void observe(int64_t us) {
+			int idx = 0;
+			while (us > bound(idx))
+				++idx;
+
+			m_buckets[idx].fetch_add(1, std::memory_order_relaxed);
+			m_count.fetch_add(1, std::memory_order_relaxed);
+			m_sum.fetch_add(us, std::memory_order_relaxed);
+		}
+
+		long count() const {
+			return m_count.load(std::memory_order_relaxed);
+		}
+
+		int64_t sum() const {
+			return m_sum.load(std::memory_order_relaxed);
+		}
+
+		long bucket(int idx) const {
+			return m_buckets[idx].load(std::memory_order_relaxed);
+		}
+
+		// upper bound of the bucket which contains @q quantile (0 < @q <= 1)
+		int64_t quantile(double q) const {
+			const long total = count();
+			if (!total)
+				return 0;
+
+			long seen = 0;
+			for (int i = 0; i < buckets; ++i) {
+				seen += bucket(i);
+				if (seen >= q * total)
+					return bound(i);
+			}
+
+			return bound(buckets - 1);
+		}
+
+	private:
+		std::atomic_long m_buckets[buckets];
+		std::atomic_long m_count;
+		std::atomic<int64_t> m_sum;
+};
+
+// Records time from construction to destruction into histogram
+class scoped_timer {
+	public:
+		explicit scoped_timer(histogram &h) : m_histogram(h) {}
+
+		~scoped_timer() {
+			m_histogram.observe(m_timer.elapsed_us());
+		}
+
+	private:
+		histogram &m_histogram;
+		wookie::timer m_timer;
+};
+
+// Registry of named counters, gauges and histograms
+//
+// Counters and histograms are created on first access and live as long as registry,
+// returned references may be cached. Gauges are callbacks sampled when snapshot is taken.
+class metrics {
+	public:
+		typedef std::function<long ()> gauge_functor;
+
+		counter &get_counter(const std::string &name);
+		histogram &get_histogram(const std::string &name);
+		void add_gauge(const std::string &name, const gauge_functor &gauge);
+
+		// one "name value" line per metric, histograms are reported as
+		// count, average and 50/90/99 percentiles in microseconds
+		std::string text();
+
+		// the same snapshot as JSON object with "counters", "gauges" and "histograms" members,
+		// histograms also contain per-bucket counts
+		std::string json();
+
+	private:
+		std::mutex m_lock;
+		std::map<std::string, std::unique_ptr<counter>> m_counters;
+		std::map<std::string, std::unique_ptr<histogram>> m_histograms;
+		std::map<std::string, gauge_functor> m_gauges;
+};
+
+// Periodically writes metrics snapshot to file, previous snapshot is replaced atomically.
+// Empty @path writes snapshot into engine log instead.
+class metrics_dumper {
+	public:
+		metrics_dumper(metrics &m, const std::string &path, int interval, bool json);
+		~metrics_dumper();
+
+	private:
+		metrics &m_metrics;
+		std::string m_path;
+		int m_interval;
+		bool m_json;
+
+		std::mutex m_lock;
+		std::condition_variable m_cond;
+		bool m_stop;
+		std::thread m_thread;
+
+		void run();
+		void dump();
+};
+
+// Minimal HTTP endpoint which serves metrics on 127.0.0.1:@port,
+// GET /metrics.json returns JSON snapshot, any other path returns text snapshot
+class metrics_server {
+	public:
+		metrics_server(metrics &m, int port);
+		~metrics_server();
+
+	private:
+		metrics &m_metrics;
+		int m_fd;
+		std::atomic_bool m_stop;
+		std::thread m_thread;
+
+		void run();
+		void serve(int fd);
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_METRICS_HPP */
@@ -55,12 +55,26 @@ class find_result {
 			return m_result_ids;
 		}
 
-		const elliptics::sync_find_indexes_result &results_find_indexes_array() const {
+		const sync_find_result &results_find_indexes_array() const {
 			return m_find_result;
 		}
 
-		const elliptics::id_to_name_map_t &index_map() const {
-			return m_map;
+		// names of indexes found documents have been tagged with, they are resolved by term dictionary
+		elliptics::id_to_name_map_t index_map() const {
+			std::vector<dnet_raw_id> ids;
+			for (auto && entry : m_find_result) {
+				for (auto && index : entry.indexes)
+					ids.push_back(index.index);
+			}
+
+			std::sort(ids.begin(), ids.end(), [] (const dnet_raw_id &a, const dnet_raw_id &b) {
+				return memcmp(a.id, b.id, DNET_ID_SIZE) < 0;
+			});
+			ids.erase(std::unique(ids.begin(), ids.end(), [] (const dnet_raw_id &a, const dnet_raw_id &b) {
+				return memcmp(a.id, b.id, DNET_ID_SIZE) == 0;
+			}), ids.end());
+
+			return m_st.terms().names(ids);
 		}
 
 	private:
@@ -73,9 +87,8 @@ class find_result {
 		std::condition_variable m_cond;
 		std::mutex m_lock;
 		elliptics::error_info m_error;
-		elliptics::sync_find_indexes_result m_find_result;
+		sync_find_result m_find_result;
 		std::vector<dnet_raw_id> m_result_ids;
-		elliptics::id_to_name_map_t m_map;
 
 		struct quote {
 			std::string 			text;
@@ -151,7 +164,8 @@ class find_result {
 				prepare_indexes(qit->text, qit->tokens);
 				str_indexes.insert(str_indexes.end(), qit->tokens.begin(), qit->tokens.end());
 
-				qit->indexes = m_st.transform_tokens(qit->tokens);
+				for (auto && token : qit->tokens)
+					qit->indexes.push_back(m_st.terms().id(token));
 			}
 
 			// grab tokens from the rest of request (unquoted text)
@@ -162,22 +176,21 @@ class find_result {
 			std::sort(str_indexes.begin(), str_indexes.end());
 			str_indexes.erase(std::unique(str_indexes.begin(), str_indexes.end()), str_indexes.end());
 
-			auto session = m_st.create_session();
-
+			// token ids are cached by term dictionary, they are not computed for every query
+			std::vector<dnet_raw_id> raw_indexes;
 			for (auto it = str_indexes.begin(); it != str_indexes.end(); ++it) {
-				elliptics::key id(*it);
-				id.transform(session);
+				const dnet_raw_id id = m_st.terms().id(*it);
 
-				m_request.mapper[*it] = id.raw_id();
-				m_map[id.raw_id()] = *it;
+				m_request.mapper[*it] = id;
+				raw_indexes.push_back(id);
 			}
 
-			session.find_all_indexes(str_indexes).connect(
+			m_st.find_all_indexes(raw_indexes).connect(
 					std::bind(&find_result::on_result_ready,
 						this, std::placeholders::_1, std::placeholders::_2));
 		}
 
-		void on_result_ready(const elliptics::sync_find_indexes_result &result,
+		void on_result_ready(const sync_find_result &result,
 				const elliptics::error_info &err) {
 			if (err || result.empty()) {
 				m_completion(*this, err);
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_RECRAWL_HPP
+#define __WOOKIE_RECRAWL_HPP
+
+#include "wookie/document.hpp"
+#include "wookie/hash.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include <stdint.h>
+#include <string.h>
+
+namespace ioremap { namespace wookie {
+
+// Change history of a single URL
+// @last_check - time URL was fetched last time
+// @last_change - time content was found changed last time
+// @interval - current recrawl interval in seconds
+// @content_hash - hash of the last fetched content
+// @checks - number of fetches
+// @changes - number of fetches which returned changed content
+struct recrawl_state {
+	dnet_time last_check;
+	dnet_time last_change;
+	uint64_t interval;
+	uint64_t content_hash;
+	uint32_t checks;
+	uint32_t changes;
+
+	enum {
+		version = 1,
+	};
+
+	recrawl_state() : interval(0), content_hash(0), checks(0), changes(0) {
+		memset(&last_check, 0, sizeof(last_check));
+		memset(&last_change, 0, sizeof(last_change));
+	}
+
+	// false if URL has never been fetched before
+	bool known() const {
+		return checks != 0;
+	}
+};
+
+// Adaptive recrawl interval
+//
+// Interval is halved every time page is found changed and grows by half every time
+// it is not, so it converges to the page change period within [@min_interval, @max_interval].
+// Due time is shifted by per-URL offset within a quarter of the interval, so pages
+// crawled together are not all due at the same moment.
+class recrawl_policy {
+	public:
+		recrawl_policy(uint64_t min_interval, uint64_t max_interval) :
+		m_min_interval(std::max<uint64_t>(1, min_interval)),
+		m_max_interval(std::max(m_min_interval, max_interval)) {
+		}
+
+		static uint64_t content_hash(const std::string &data) {
+			return hash::murmur(data, 0);
+		}
+
+		// accounts fetch which returned @data at @now, @not_modified is true for '304 Not Modified' reply
+		void update(recrawl_state &st, const std::string &data, bool not_modified, const dnet_time &now) const {
+			update(st, content_hash(data), not_modified, now);
+		}
+
+		// @hash - content_hash() of fetched data
+		void update(recrawl_state &st, uint64_t hash, bool not_modified, const dnet_time &now) const {
+			const uint64_t h = (not_modified && st.known()) ? st.content_hash : hash;
+			const bool changed = st.known() && h != st.content_hash;
+
+			if (!st.known()) {
+				st.interval = m_min_interval;
+				st.last_change = now;
+			} else if (changed) {
+				st.interval = std::max(m_min_interval, st.interval / 2);
+				st.last_change = now;
+				++st.changes;
+			} else {
+				st.interval = std::min(m_max_interval, st.interval + st.interval / 2 + 1);
+			}
+
+			st.content_hash = h;
+			st.last_check = now;
+			++st.checks;
+		}
+
+		// time in seconds when @url should be fetched again
+		uint64_t due(const recrawl_state &st, const std::string &url) const {
+			return due(st, hash::murmur(url, 0));
+		}
+
+		bool is_due(const recrawl_state &st, const std::string &url, const dnet_time &now) const {
+			return is_due(st, hash::murmur(url, 0), now);
+		}
+
+		// @url_id - URL fingerprint as assigned by url_table, it defines due time offset
+		uint64_t due(const recrawl_state &st, uint64_t url_id) const {
+			const uint64_t interval = std::min(m_max_interval, std::max(m_min_interval, st.interval));
+			const uint64_t spread = interval / 4 + 1;
+
+			return st.last_check.tsec + interval - interval / 8 + url_id % spread;
+		}
+
+		bool is_due(const recrawl_state &st, uint64_t url_id, const dnet_time &now) const {
+			return !st.known() || due(st, url_id) <= now.tsec;
+		}
+
+	private:
+		uint64_t m_min_interval;
+		uint64_t m_max_interval;
+};
+
+}} // namespace ioremap::wookie
+
+namespace msgpack {
+static inline ioremap::wookie::recrawl_state &operator >>(msgpack::object o, ioremap::wookie::recrawl_state &st)
+{
+	if (o.type != msgpack::type::ARRAY || o.via.array.size != 7)
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: recrawl state array size mismatch: compiled: %d, unpacked: %d",
+				7, o.via.array.size);
+
+	object *p = o.via.array.ptr;
+
+	int version;
+	p[0].convert(&version);
+
+	if (version != ioremap::wookie::recrawl_state::version)
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: recrawl state version mismatch: compiled: %d, unpacked: %d",
+				ioremap::wookie::recrawl_state::version, version);
+
+	p[1].convert(&st.last_check);
+	p[2].convert(&st.last_change);
+	p[3].convert(&st.interval);
+	p[4].convert(&st.content_hash);
+	p[5].convert(&st.checks);
+	p[6].convert(&st.changes);
+
+	return st;
+}
+
+template <typename Stream>
+inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const ioremap::wookie::recrawl_state &st)
+{
+	o.pack_array(7);
+	o.pack(static_cast<int>(ioremap::wookie::recrawl_state::version));
+	o.pack(st.last_check);
+	o.pack(st.last_change);
+	o.pack(st.interval);
+	o.pack(st.content_hash);
+	o.pack(st.checks);
+	o.pack(st.changes);
+
+	return o;
+}
+
+} /* namespace msgpack */
+
+#endif /* __WOOKIE_RECRAWL_HPP */
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_REPLY_STREAM_HPP
+#define __WOOKIE_REPLY_STREAM_HPP
+
+#include <swarm/urlfetcher/url_fetcher.hpp>
+#include <swarm/urlfetcher/stream.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace ioremap { namespace wookie {
+
+// Incremental consumer of downloaded reply
+//
+// Body is delivered in chunks as it arrives from the network, downloader does not
+// keep its own copy. All methods are called from downloader thread.
+class reply_stream {
+	public:
+		virtual ~reply_stream() {}
+
+		// called once before the first chunk, returning false drops the body: it is still
+		// received, but not delivered, on_close() will then be called with error
+		virtual bool on_headers(const swarm::url_fetcher::response &reply) {
+			(void) reply;
+			return true;
+		}
+
+		virtual void on_data(const char *data, size_t size) = 0;
+
+		// @reply - reply headers, also passed to on_headers() if they were received
+		virtual void on_close(const swarm::url_fetcher::response &reply, const boost::system::error_code &error) = 0;
+};
+
+typedef std::shared_ptr<reply_stream> shared_reply_stream;
+
+// Collects the whole body and hands it over to handler, body string is moved into it
+class buffered_stream : public reply_stream {
+	public:
+		typedef std::function<void (const swarm::url_fetcher::response &reply, std::string &&data,
+				const boost::system::error_code &error)> handler_func;
+
+		enum {
+			// announced size is preallocated up to this limit, larger body grows as it arrives
+			max_reserve = 4 * 1024 * 1024,
+		};
+
+		explicit buffered_stream(const handler_func &handler) : m_handler(handler) {}
+
+		// body is preallocated when server announced its size, Content-Length is not trusted
+		// beyond @max_reserve, since body size may be unlimited
+		virtual bool on_headers(const swarm::url_fetcher::response &reply) {
+			if (auto size = reply.headers().content_length())
+				m_data.reserve(std::min<size_t>(*size, max_reserve));
+
+			return true;
+		}
+
+		virtual void on_data(const char *data, size_t size) {
+			m_data.append(data, size);
+		}
+
+		virtual void on_close(const swarm::url_fetcher::response &reply, const boost::system::error_code &error) {
+			m_handler(reply, std::move(m_data), error);
+		}
+
+	private:
+		handler_func m_handler;
+		std::string m_data;
+};
+
+// Adapts swarm handler, it receives the same string it used to get from swarm::simple_stream
+static inline shared_reply_stream make_buffered_stream(const swarm::simple_stream::handler_func &handler)
+{
+	return std::make_shared<buffered_stream>([handler] (const swarm::url_fetcher::response &reply, std::string &&data,
+				const boost::system::error_code &error) {
+		handler(reply, data, error);
+	});
+}
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_REPLY_STREAM_HPP */
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_SIMHASH_HPP
+#define __WOOKIE_SIMHASH_HPP
+
+#include "wookie/hash.hpp"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <msgpack.hpp>
+
+#include <elliptics/cppdef.h>
+
+#include <stdint.h>
+
+namespace ioremap { namespace wookie { namespace simhash {
+
+enum {
+	// number of consecutive words hashed together
+	shingle_size = 3,
+
+	// fingerprint is split into this number of bands, every band is a separate
+	// secondary index, two fingerprints which differ in at most @bands - 1 bits
+	// have at least one equal band
+	bands = 4,
+	band_bits = 64 / bands,
+};
+
+// 64-bit SimHash fingerprint of word shingles, returns 0 if there are not enough words
+static inline uint64_t fingerprint(const std::vector<std::string> &words)
+{
+	if (words.size() < shingle_size)
+		return 0;
+
+	int weights[64] = { 0 };
+
+	std::string shingle;
+	for (size_t i = 0; i + shingle_size <= words.size(); ++i) {
+		shingle.clear();
+		for (size_t j = i; j < i + shingle_size; ++j) {
+			shingle.append(words[j]);
+			shingle.push_back(' ');
+		}
+
+		const uint64_t h = hash::murmur(shingle, 0);
+		for (int bit = 0; bit < 64; ++bit)
+			weights[bit] += (h & (1ULL << bit)) ? 1 : -1;
+	}
+
+	uint64_t fp = 0;
+	for (int bit = 0; bit < 64; ++bit) {
+		if (weights[bit] > 0)
+			fp |= 1ULL << bit;
+	}
+
+	return fp;
+}
+
+static inline int distance(uint64_t a, uint64_t b)
+{
+	return __builtin_popcountll(a ^ b);
+}
+
+// names of secondary indexes which host documents with the same fingerprint bands
+static inline std::vector<std::string> band_indexes(uint64_t fp)
+{
+	std::vector<std::string> indexes;
+
+	for (int band = 0; band < bands; ++band) {
+		std::ostringstream ss;
+		ss << "simhash." << band << "." << ((fp >> (band * band_bits)) & ((1ULL << band_bits) - 1));
+		indexes.emplace_back(ss.str());
+	}
+
+	return indexes;
+}
+
+// index data stored in every band index
+// @fp - full fingerprint of the document
+// @key - storage key of the document
+struct fingerprint_data {
+	uint64_t fp;
+	std::string key;
+
+	enum {
+		version = 1,
+	};
+
+	fingerprint_data() : fp(0) {}
+	fingerprint_data(uint64_t fp, const std::string &key) : fp(fp), key(key) {}
+};
+
+}}} // namespace ioremap::wookie::simhash
+
+namespace msgpack {
+static inline ioremap::wookie::simhash::fingerprint_data &operator >>(msgpack::object o,
+		ioremap::wookie::simhash::fingerprint_data &d)
+{
+	if (o.type != msgpack::type::ARRAY || o.via.array.size != 3)
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: fingerprint data array size mismatch: compiled: %d, unpacked: %d",
+				3, o.via.array.size);
+
+	object *p = o.via.array.ptr;
+
+	int version;
+	p[0].convert(&version);
+
+	if (version != ioremap::wookie::simhash::fingerprint_data::version)
+		ioremap::elliptics::throw_error(-EPROTO, "msgpack: fingerprint data version mismatch: compiled: %d, unpacked: %d",
+				ioremap::wookie::simhash::fingerprint_data::version, version);
+
+	p[1].convert(&d.fp);
+	p[2].convert(&d.key);
+
+	return d;
+}
+
+template <typename Stream>
+inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const ioremap::wookie::simhash::fingerprint_data &d)
+{
+	o.pack_array(3);
+	o.pack(static_cast<int>(ioremap::wookie::simhash::fingerprint_data::version));
+	o.pack(d.fp);
+	o.pack(d.key);
+
+	return o;
+}
+
+} /* namespace msgpack */
+
+#endif /* __WOOKIE_SIMHASH_HPP */
@@ -19,6 +19,11 @@
 
 #include "split.hpp"
 #include "index_data.hpp"
+#include "simhash.hpp"
+#include "recrawl.hpp"
+#include "index_writer.hpp"
+#include "storage_backend.hpp"
+#include "term_dictionary.hpp"
 
 #include <elliptics/session.hpp>
 
@@ -28,32 +33,97 @@ namespace ioremap { namespace wookie {
 
 class storage {
 	public:
-		explicit storage(elliptics::node &&node);
+		enum {
+			max_alias_hops = 8,
+		};
+
+		// elliptics backend on top of @sess
+		explicit storage(const elliptics::session &sess);
+		explicit storage(std::unique_ptr<storage_backend> &&backend);
+		~storage();
 
-		void set_groups(const std::vector<int> groups);
         	void set_namespace(const std::string &ns);
 
+		// backend storage works through, see wookie/storage_backend.hpp
+		storage_backend &backend();
+
 		std::vector<elliptics::find_indexes_result_entry> find(const std::vector<std::string> &indexes);
 		std::vector<elliptics::find_indexes_result_entry> find(const std::vector<dnet_raw_id> &indexes);
+		async_find_result find_all_indexes(const std::vector<dnet_raw_id> &indexes);
+
+		// replaces all indexes of document @key, index names are transformed in storage namespace
+		async_write_result set_indexes(const std::string &key, const std::vector<std::string> &indexes,
+				const std::vector<elliptics::data_pointer> &datas);
+		// indexes in @updates are already transformed
+		std::vector<async_write_result> bulk_set_indexes(const std::vector<index_update> &updates);
+
+		// batched document index updates, see wookie/index_writer.hpp
+		index_writer &indexer();
 
-		elliptics::async_write_result write_document(ioremap::wookie::document &d);
-		elliptics::async_read_result read_data(const elliptics::key &key);
+		async_write_result write_document(const ioremap::wookie::document &d);
+		async_read_result read_data(const elliptics::key &key);
+		async_read_result bulk_read_data(const std::vector<std::string> &keys);
 
+		// follows aliases, throws -ELOOP if there are more than @max_alias_hops of them in a chain
 		document read_document(const elliptics::key &key);
 
+		// documents are packed straight into the buffer which is sent to storage
 		static elliptics::data_pointer pack_document(const std::string &url, const std::string &data);
-		static elliptics::data_pointer pack_document(ioremap::wookie::document &doc);
+		static elliptics::data_pointer pack_document(const ioremap::wookie::document &doc);
 		static document unpack_document(const elliptics::data_pointer &result);
 
+		// key and body of returned document reference @result, nothing is copied
+		static document_view unpack_document_view(const elliptics::data_pointer &result);
+
+		async_write_result write_alias(const std::string &key, const document_alias &alias);
+
+		// metadata of document or alias stored under @key, it is much smaller than document
+		// and is read without its body, see document_meta
+		async_write_result write_document_meta(const std::string &key, const document_meta &meta);
+		async_read_result read_document_meta(const std::string &key);
+		async_read_result bulk_read_document_meta(const std::vector<std::string> &keys);
+
+		// ids bulk_read_document_meta() replies carry for @keys, they differ from document ids
+		std::vector<dnet_raw_id> transform_meta_keys(const std::vector<std::string> &keys);
+		static document_meta unpack_document_meta(const elliptics::data_pointer &result);
+		static bool is_alias(const elliptics::data_pointer &result);
+		static document_alias unpack_alias(const elliptics::data_pointer &result);
+
+		// near-duplicate fingerprint index, see wookie/simhash.hpp
+		async_write_result add_fingerprint(const std::string &key, uint64_t fp);
+		async_find_result find_fingerprints(uint64_t fp);
+
+		// per-URL change history, see wookie/recrawl.hpp
+		async_write_result write_recrawl_state(const std::string &key, const recrawl_state &st);
+		async_read_result read_recrawl_state(const std::string &key);
+		static recrawl_state unpack_recrawl_state(const elliptics::data_pointer &result);
+
 		std::vector<dnet_raw_id> transform_tokens(const std::vector<std::string> &tokens);
 
+		// index token dictionary, see wookie/term_dictionary.hpp
+		term_dictionary &terms();
+		async_read_result read_term_record(const std::string &key);
+		async_write_result append_term_record(const std::string &key, const elliptics::data_pointer &data);
+
+		// session of elliptics backend, throws -ENOTSUP if storage works through another one
 		elliptics::session create_session(void);
-		elliptics::node get_node();
 
 	private:
-		elliptics::node m_node;
-		elliptics::session m_sess;
+		std::unique_ptr<storage_backend> m_backend;
+		std::string m_namespace;
 		wookie::split m_spl;
+
+		// flushed on destruction, must go before backend it writes through
+		std::unique_ptr<term_dictionary> m_terms;
+		// updates term dictionary, must go after it
+		std::unique_ptr<index_writer> m_indexer;
+
+		std::string fingerprint_namespace() const;
+		std::string recrawl_namespace() const;
+		std::string meta_namespace() const;
+		std::string terms_namespace() const;
+
+		std::vector<dnet_raw_id> transform(const std::string &ns, const std::vector<std::string> &tokens);
 };
 
 }}
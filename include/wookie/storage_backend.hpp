@@ -0,0 +1,403 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_STORAGE_BACKEND_HPP
+#define __WOOKIE_STORAGE_BACKEND_HPP
+
+#include <elliptics/session.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <string.h>
+
+namespace ioremap { namespace wookie {
+
+struct raw_id_hash {
+	size_t operator() (const dnet_raw_id &id) const {
+		size_t h;
+		memcpy(&h, id.id, sizeof(h));
+		return h;
+	}
+};
+
+struct raw_id_equal {
+	bool operator() (const dnet_raw_id &a, const dnet_raw_id &b) const {
+		return memcmp(a.id, b.id, DNET_ID_SIZE) == 0;
+	}
+};
+
+// @id - ID object is stored under
+// @data - object content
+struct read_entry {
+	dnet_raw_id id;
+	elliptics::data_pointer data;
+};
+
+// @id - ID of object which has been written or whose indexes have been changed
+struct write_entry {
+	dnet_raw_id id;
+};
+
+// Result of asynchronous storage operation
+//
+// Backend reports entries with process() and finishes result with complete(), it may do that
+// from any thread, including the one which started operation, before result is returned.
+// Entries reported before handlers are connected are stored and replayed on connect(),
+// final handler is called exactly once after all entries. Copies share the same state.
+template <typename T>
+class async_result {
+	public:
+		typedef std::function<void (const T &)> entry_handler;
+		typedef std::function<void (const elliptics::error_info &)> final_handler;
+		typedef std::function<void (const std::vector<T> &, const elliptics::error_info &)> result_handler;
+
+		async_result() : m_state(std::make_shared<state>()) {}
+
+		void process(const T &entry) {
+			entry_handler handler;
+			{
+				std::unique_lock<std::mutex> guard(m_state->lock);
+				m_state->entries.push_back(entry);
+				handler = m_state->on_entry;
+			}
+
+			if (handler)
+				handler(entry);
+		}
+
+		void complete(const elliptics::error_info &error) {
+			final_handler handler;
+			{
+				std::unique_lock<std::mutex> guard(m_state->lock);
+				m_state->error = error;
+				m_state->completed = true;
+
+				if (!m_state->replaying)
+					handler = release_handlers();
+
+				m_state->cond.notify_all();
+			}
+
+			if (handler)
+				handler(error);
+		}
+
+		// @on_entry is called for every entry, @on_final when there are no more of them
+		void connect(const entry_handler &on_entry, const final_handler &on_final) {
+			std::vector<T> replay;
+			{
+				std::unique_lock<std::mutex> guard(m_state->lock);
+				m_state->on_entry = on_entry;
+				m_state->on_final = on_final;
+				m_state->replaying = true;
+
+				if (on_entry)
+					replay = m_state->entries;
+			}
+
+			for (auto && entry : replay)
+				on_entry(entry);
+
+			final_handler handler;
+			{
+				std::unique_lock<std::mutex> guard(m_state->lock);
+				m_state->replaying = false;
+
+				if (m_state->completed)
+					handler = release_handlers();
+			}
+
+			if (handler)
+				handler(m_state->error);
+		}
+
+		// @handler gets all entries at once when result is completed
+		void connect(const result_handler &handler) {
+			std::shared_ptr<state> st = m_state;
+			connect(entry_handler(), [st, handler] (const elliptics::error_info &error) {
+				handler(st->entries, error);
+			});
+		}
+
+		void wait() {
+			std::unique_lock<std::mutex> guard(m_state->lock);
+			while (!m_state->completed)
+				m_state->cond.wait(guard);
+		}
+
+		// returns false if result has not been completed within @timeout
+		bool wait_for(const std::chrono::milliseconds &timeout) {
+			std::unique_lock<std::mutex> guard(m_state->lock);
+			return m_state->cond.wait_for(guard, timeout, [this] () { return m_state->completed; });
+		}
+
+		const std::vector<T> &get() {
+			wait();
+			return m_state->entries;
+		}
+
+		elliptics::error_info error() {
+			wait();
+			return m_state->error;
+		}
+
+	private:
+		struct state {
+			std::mutex lock;
+			std::condition_variable cond;
+
+			std::vector<T> entries;
+			elliptics::error_info error;
+			bool completed;
+			bool replaying;
+
+			entry_handler on_entry;
+			final_handler on_final;
+
+			state() : completed(false), replaying(false) {}
+		};
+
+		std::shared_ptr<state> m_state;
+
+		// handlers are dropped once result is completed, they may hold references to the state
+		// must be called with state lock held
+		final_handler release_handlers() {
+			final_handler handler;
+			handler.swap(m_state->on_final);
+			m_state->on_entry = entry_handler();
+			return handler;
+		}
+};
+
+typedef async_result<read_entry> async_read_result;
+typedef async_result<write_entry> async_write_result;
+typedef async_result<elliptics::find_indexes_result_entry> async_find_result;
+
+// @key - document whose indexes are replaced
+// @indexes - all indexes of the document and its data in them
+struct index_update {
+	std::string key;
+	std::vector<elliptics::index_entry> indexes;
+};
+
+typedef std::vector<read_entry> sync_read_result;
+typedef std::vector<write_entry> sync_write_result;
+typedef std::vector<elliptics::find_indexes_result_entry> sync_find_result;
+
+// Storage wookie::storage reads and writes objects and secondary indexes through
+//
+// Objects are addressed by key in namespace (@ns), key is transformed into ID by backend,
+// keys which already are IDs are used as is. Secondary index is a set of object IDs each
+// with its own data, index IDs are computed by transform() by caller.
+class storage_backend {
+	public:
+		virtual ~storage_backend() {}
+
+		// IDs objects @keys are stored under in namespace @ns
+		virtual std::vector<dnet_raw_id> transform(const std::string &ns, const std::vector<std::string> &keys) = 0;
+
+		dnet_raw_id transform(const std::string &ns, const std::string &key) {
+			return transform(ns, std::vector<std::string>(1, key))[0];
+		}
+
+		virtual async_write_result write(const std::string &ns, const elliptics::key &key,
+				const elliptics::data_pointer &data) = 0;
+		// appends @data to the end of object, object is created if it does not exist
+		virtual async_write_result append(const std::string &ns, const elliptics::key &key,
+				const elliptics::data_pointer &data) = 0;
+
+		// fails with -ENOENT if there is no such object
+		virtual async_read_result read(const std::string &ns, const elliptics::key &key) = 0;
+		// objects which do not exist are not reported, entries may come in any order
+		virtual async_read_result bulk_read(const std::string &ns, const std::vector<std::string> &keys) = 0;
+
+		// replaces all indexes of object @key with @indexes
+		virtual async_write_result set_indexes(const std::string &ns, const std::string &key,
+				const std::vector<elliptics::index_entry> &indexes) = 0;
+		// adds object @key into @indexes or updates its data there, other indexes are not touched
+		virtual async_write_result update_indexes(const std::string &ns, const std::string &key,
+				const std::vector<elliptics::index_entry> &indexes) = 0;
+
+		// set_indexes() for many objects at once, result of every update is reported separately,
+		// this implementation issues all of them without waiting for any
+		virtual std::vector<async_write_result> bulk_set_indexes(const std::string &ns,
+				const std::vector<index_update> &updates);
+
+		// objects which are in all of @indexes
+		virtual async_find_result find_all_indexes(const std::vector<dnet_raw_id> &indexes) = 0;
+		// objects which are in at least one of @indexes
+		virtual async_find_result find_any_indexes(const std::vector<dnet_raw_id> &indexes) = 0;
+};
+
+// elliptics cluster, the only backend which is shared between machines
+class elliptics_backend : public storage_backend {
+	public:
+		explicit elliptics_backend(elliptics::node &&node);
+		// session is cloned, its groups, namespace and flags are kept
+		explicit elliptics_backend(const elliptics::session &sess);
+
+		void set_groups(const std::vector<int> &groups);
+		elliptics::node get_node();
+
+		// session for namespace @ns, empty namespace means no namespace at all
+		elliptics::session create_session(const std::string &ns);
+
+		using storage_backend::transform;
+		virtual std::vector<dnet_raw_id> transform(const std::string &ns, const std::vector<std::string> &keys);
+
+		virtual async_write_result write(const std::string &ns, const elliptics::key &key,
+				const elliptics::data_pointer &data);
+		virtual async_write_result append(const std::string &ns, const elliptics::key &key,
+				const elliptics::data_pointer &data);
+
+		virtual async_read_result read(const std::string &ns, const elliptics::key &key);
+		virtual async_read_result bulk_read(const std::string &ns, const std::vector<std::string> &keys);
+
+		virtual async_write_result set_indexes(const std::string &ns, const std::string &key,
+				const std::vector<elliptics::index_entry> &indexes);
+		virtual async_write_result update_indexes(const std::string &ns, const std::string &key,
+				const std::vector<elliptics::index_entry> &indexes);
+
+		virtual async_find_result find_all_indexes(const std::vector<dnet_raw_id> &indexes);
+		virtual async_find_result find_any_indexes(const std::vector<dnet_raw_id> &indexes);
+
+	private:
+		elliptics::session m_sess;
+};
+
+// Secondary indexes kept in memory, used by local backends
+// It is not thread safe, backend serializes access to it
+class index_table {
+	public:
+		// returns false if object has not been in any index and there is nothing to remove
+		bool remove(const dnet_raw_id &object);
+		void update(const dnet_raw_id &object, const std::vector<elliptics::index_entry> &indexes);
+
+		sync_find_result find_all(const std::vector<dnet_raw_id> &indexes) const;
+		sync_find_result find_any(const std::vector<dnet_raw_id> &indexes) const;
+
+	private:
+		typedef std::unordered_map<dnet_raw_id, elliptics::data_pointer, raw_id_hash, raw_id_equal> object_map;
+
+		// index ID -> objects in it and their data
+		std::unordered_map<dnet_raw_id, object_map, raw_id_hash, raw_id_equal> m_indexes;
+		// object ID -> indexes it is in
+		std::unordered_map<dnet_raw_id, std::vector<dnet_raw_id>, raw_id_hash, raw_id_equal> m_objects;
+};
+
+// Local backends complete every operation before returning its result
+//
+// Their IDs are not elliptics IDs: they are built of MurmurHash64A of namespace and key,
+// objects written by one backend can not be found by ID in another one.
+
+// Everything is kept in memory and lost at exit, object data is referenced, not copied
+class memory_backend : public storage_backend {
+	public:
+		using storage_backend::transform;
+		virtual std::vector<dnet_raw_id> transform(const std::string &ns, const std::vector<std::string> &keys);
+
+		virtual async_write_result write(const std::string &ns, const elliptics::key &key,
+				const elliptics::data_pointer &data);
+		virtual async_write_result append(const std::string &ns, const elliptics::key &key,
+				const elliptics::data_pointer &data);
+
+		virtual async_read_result read(const std::string &ns, const elliptics::key &key);
+		virtual async_read_result bulk_read(const std::string &ns, const std::vector<std::string> &keys);
+
+		virtual async_write_result set_indexes(const std::string &ns, const std::string &key,
+				const std::vector<elliptics::index_entry> &indexes);
+		virtual async_write_result update_indexes(const std::string &ns, const std::string &key,
+				const std::vector<elliptics::index_entry> &indexes);
+		virtual std::vector<async_write_result> bulk_set_indexes(const std::string &ns,
+				const std::vector<index_update> &updates);
+
+		virtual async_find_result find_all_indexes(const std::vector<dnet_raw_id> &indexes);
+		virtual async_find_result find_any_indexes(const std::vector<dnet_raw_id> &indexes);
+
+	private:
+		std::mutex m_lock;
+		std::unordered_map<dnet_raw_id, elliptics::data_pointer, raw_id_hash, raw_id_equal> m_objects;
+		index_table m_indexes;
+};
+
+// Objects are files in @path: <path>/<first ID byte in hex>/<ID in hex>, they are replaced
+// atomically by rename(). Indexes are kept in memory and every change of them is appended
+// to <path>/indexes.log, which is replayed when backend is opened. Log is not compacted,
+// it grows with every set_indexes() call. Objects are not synced to disk, log is synced on close.
+class file_backend : public storage_backend {
+	public:
+		// creates @path if it does not exist, throws std::runtime_error if it can not be used
+		explicit file_backend(const std::string &path);
+		~file_backend();
+
+		file_backend(const file_backend &) = delete;
+		file_backend &operator =(const file_backend &) = delete;
+
+		using storage_backend::transform;
+		virtual std::vector<dnet_raw_id> transform(const std::string &ns, const std::vector<std::string> &keys);
+
+		virtual async_write_result write(const std::string &ns, const elliptics::key &key,
+				const elliptics::data_pointer &data);
+		virtual async_write_result append(const std::string &ns, const elliptics::key &key,
+				const elliptics::data_pointer &data);
+
+		virtual async_read_result read(const std::string &ns, const elliptics::key &key);
+		virtual async_read_result bulk_read(const std::string &ns, const std::vector<std::string> &keys);
+
+		virtual async_write_result set_indexes(const std::string &ns, const std::string &key,
+				const std::vector<elliptics::index_entry> &indexes);
+		virtual async_write_result update_indexes(const std::string &ns, const std::string &key,
+				const std::vector<elliptics::index_entry> &indexes);
+		// all updates are appended to the log with a single write
+		virtual std::vector<async_write_result> bulk_set_indexes(const std::string &ns,
+				const std::vector<index_update> &updates);
+
+		virtual async_find_result find_all_indexes(const std::vector<dnet_raw_id> &indexes);
+		virtual async_find_result find_any_indexes(const std::vector<dnet_raw_id> &indexes);
+
+	private:
+		enum log_record_type {
+			record_set = 'S',
+			record_update = 'U',
+		};
+
+		std::string m_path;
+		int m_log_fd;
+
+		std::mutex m_lock;
+		index_table m_indexes;
+
+		std::string object_path(const dnet_raw_id &id, bool create_dir);
+		int write_object(const dnet_raw_id &id, const elliptics::data_pointer &data, bool append);
+		int read_object(const dnet_raw_id &id, elliptics::data_pointer &data);
+
+		// returns size of the valid part of the log, torn record at the end is not counted
+		size_t replay_log();
+		static void pack_log_record(std::string &out, char type, const dnet_raw_id &object,
+				const std::vector<elliptics::index_entry> &indexes);
+		int append_log(const std::string &records);
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_STORAGE_BACKEND_HPP */
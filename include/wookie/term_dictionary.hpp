@@ -0,0 +1,121 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_TERM_DICTIONARY_HPP
+#define __WOOKIE_TERM_DICTIONARY_HPP
+
+#include "storage_backend.hpp"
+
+#include <elliptics/session.hpp>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ioremap { namespace wookie {
+
+class storage;
+
+// @term - index token name
+// @df - number of documents indexed with this token
+struct term_info {
+	std::string term;
+	uint64_t df;
+
+	term_info() : df(0) {}
+};
+
+// Persistent dictionary of index tokens: index ID <-> token name and document frequency
+//
+// Every token is stored once in its own record in '<namespace>.terms', keyed by the index ID
+// of the token, so postings do not need to carry token names. Records are append-only:
+// every flush appends [version, term, df increment] msgpack array to the record, df is
+// the sum of all increments, so several indexers may update the same token concurrently.
+// Records are never compacted, they grow by one small array per flush which touched the token.
+//
+// Tokens are cached in memory, storage is read only for IDs which are not cached yet.
+// Cache is bounded: when it holds more than @max_cached_terms tokens, all tokens without
+// pending increments are dropped and will be read again when needed.
+// Document frequency counts indexing operations, document indexed again is counted again.
+class term_dictionary {
+	public:
+		enum {
+			version = 1,
+
+			// pending increments are flushed when this many tokens have been changed
+			flush_threshold = 10000,
+
+			max_cached_terms = 1000000,
+		};
+
+		explicit term_dictionary(storage &st);
+		~term_dictionary();
+
+		term_dictionary(const term_dictionary &) = delete;
+		term_dictionary &operator =(const term_dictionary &) = delete;
+
+		// index ID of @term, it is taken from cache if token is known, otherwise it is computed
+		// and not remembered, so arbitrary search queries do not grow dictionary
+		dnet_raw_id id(const std::string &term);
+
+		// index IDs of @terms in the same order, tokens which are not cached yet are transformed at once
+		// and cached, it is used by indexers
+		std::vector<dnet_raw_id> ids(const std::vector<std::string> &terms);
+
+		// accounts one more document for every token in @terms, increments are written
+		// by flush() which is called when enough of them have been collected
+		void add_document(const std::vector<std::string> &terms);
+
+		// looks up token of index @id, reads it from storage if it is not cached,
+		// returns false if dictionary does not know such token
+		bool lookup(const dnet_raw_id &id, term_info &info);
+
+		// names of all known tokens among @ids
+		elliptics::id_to_name_map_t names(const std::vector<dnet_raw_id> &ids);
+
+		// appends pending increments to storage and waits for writes to complete,
+		// increments which could not be written stay pending and are retried by the next flush
+		void flush();
+
+	private:
+		// @info - token and its document frequency read from storage (valid if @loaded is set)
+		// @pending - document frequency increment which has not been flushed yet
+		struct entry {
+			term_info info;
+			uint64_t pending;
+			bool loaded;
+
+			entry() : pending(0), loaded(false) {}
+		};
+
+		storage &m_st;
+
+		std::mutex m_lock;
+		std::unordered_map<dnet_raw_id, entry, raw_id_hash, raw_id_equal> m_entries;
+		std::unordered_map<std::string, dnet_raw_id> m_ids;
+		size_t m_dirty;
+
+		dnet_raw_id insert(const std::string &term, const dnet_raw_id &id);
+		void shrink();
+		int read_record(const dnet_raw_id &id, term_info &info);
+		static std::string record_key(const dnet_raw_id &id);
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_TERM_DICTIONARY_HPP */
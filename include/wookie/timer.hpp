@@ -50,6 +50,12 @@ public:
 		return t;
 	}
 
+	// microseconds since construction or last restart, not rounded up
+	int64_t elapsed_us() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - m_last_time).count();
+	}
+
 private:
 	clock::time_point m_last_time;
 };
@@ -19,6 +19,10 @@
 
 #include <magic.h>
 
+#include <stdexcept>
+
+#include <string.h>
+
 namespace ioremap { namespace wookie {
 
 namespace url {
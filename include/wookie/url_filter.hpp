@@ -0,0 +1,92 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_URL_FILTER_HPP
+#define __WOOKIE_URL_FILTER_HPP
+
+#include <bitset>
+#include <regex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace ioremap { namespace wookie {
+
+// Declarative description of links which are allowed to be crawled
+// @hosts - allowed hosts, any host is allowed if empty
+// @ports - allowed ports, URLs without explicit port are always allowed, any port is allowed if empty
+// @forbidden_words - URL must not contain any of these substrings, match which starts
+//	at the last character of URL is ignored (trailing slash and similar)
+// @forbidden_patterns - URL must not match any of these ECMAScript regular expressions
+struct url_filter_spec {
+	std::vector<std::string> hosts;
+	std::vector<int> ports;
+	std::vector<std::string> forbidden_words;
+	std::vector<std::string> forbidden_patterns;
+};
+
+// Multi-pattern substring matcher
+//
+// Patterns are compiled into Aho-Corasick automaton with full transition table,
+// text is scanned once regardless of number of patterns.
+class aho_corasick {
+	public:
+		explicit aho_corasick(const std::vector<std::string> &patterns);
+
+		bool empty() const {
+			return m_states.size() <= 1;
+		}
+
+		// returns true if any pattern occurs in @text, occurrence of single-character
+		// pattern at the last character of @text is ignored when @skip_last is set
+		bool search(const std::string &text, bool skip_last) const;
+
+	private:
+		struct state {
+			int next[256];
+			int fail;
+
+			// length of the longest pattern which ends in this state, 0 if none
+			int match;
+		};
+
+		std::vector<state> m_states;
+};
+
+// URL filter compiled from url_filter_spec
+//
+// Checks are ordered from the cheapest one: host hash set, port bitset,
+// one Aho-Corasick pass over URL and regular expressions last.
+class url_matcher {
+	public:
+		explicit url_matcher(const url_filter_spec &spec);
+
+		// @host - host of absolute URL, @port - its explicit port or 0, @url - normalized URL string
+		bool check(const std::string &host, int port, const std::string &url) const;
+
+	private:
+		std::unordered_set<std::string> m_hosts;
+
+		bool m_any_port;
+		std::bitset<65536> m_ports;
+
+		aho_corasick m_words;
+		std::vector<std::regex> m_patterns;
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_URL_FILTER_HPP */
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_URL_TABLE_HPP
+#define __WOOKIE_URL_TABLE_HPP
+
+#include "wookie/hash.hpp"
+
+#include <swarm/url.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+
+namespace ioremap { namespace wookie {
+
+// URL normalized once
+// @id - 64-bit fingerprint of @str, it is used by inflight registry, journal and seen filter
+// @str - canonical URL string, it is used as storage key
+struct url_entry {
+	uint64_t id;
+	std::string str;
+};
+
+typedef std::shared_ptr<const url_entry> interned_url;
+
+// Interning table of URLs which are being processed
+//
+// Every URL is serialized and hashed once, all holders of the same URL share one entry.
+// Entry is removed from the table when its last holder releases it, so table size
+// is bounded by the number of URLs in flight, not by the crawl size.
+class url_table {
+	public:
+		explicit url_table(size_t shards_num = 64) : m_shards(shards_num), m_size(0) {
+		}
+
+		url_table(const url_table &) = delete;
+		url_table &operator =(const url_table &) = delete;
+
+		static uint64_t fingerprint(const std::string &url) {
+			return hash::murmur(url, 0);
+		}
+
+		// canonical form drops fragment, it never reaches the server
+		static std::string canonical(const std::string &url) {
+			return url.substr(0, url.find('#'));
+		}
+
+		interned_url intern(const swarm::url &url) {
+			return intern(url.to_string());
+		}
+
+		interned_url intern(const std::string &url) {
+			std::string str = canonical(url);
+			const uint64_t id = fingerprint(str);
+			shard &sh = get_shard(id);
+
+			std::unique_lock<std::mutex> guard(sh.lock);
+
+			// expired slot is reused, release() of its previous entry will find it alive and keep it
+			auto slot = sh.entries.emplace(id, std::weak_ptr<const url_entry>());
+			if (interned_url e = slot.first->second.lock()) {
+				if (e->str == str)
+					return e;
+
+				// fingerprint collision, other URL owns the slot, this one gets its own
+				// entry which is not shared through the table
+				return std::make_shared<const url_entry>(url_entry{id, std::move(str)});
+			}
+
+			url_entry *e = new url_entry;
+			e->id = id;
+			e->str = std::move(str);
+
+			interned_url ret(e, [this] (const url_entry *e) {
+				release(e->id);
+				delete e;
+			});
+
+			if (slot.second)
+				++m_size;
+			slot.first->second = ret;
+			return ret;
+		}
+
+		size_t size() const {
+			return m_size;
+		}
+
+	private:
+		struct shard {
+			std::mutex lock;
+			std::unordered_map<uint64_t, std::weak_ptr<const url_entry>> entries;
+		};
+
+		std::vector<shard> m_shards;
+		std::atomic_long m_size;
+
+		shard &get_shard(uint64_t id) {
+			return m_shards[id % m_shards.size()];
+		}
+
+		void release(uint64_t id) {
+			shard &sh = get_shard(id);
+
+			std::unique_lock<std::mutex> guard(sh.lock);
+			auto it = sh.entries.find(id);
+			if (it != sh.entries.end() && it->second.expired()) {
+				sh.entries.erase(it);
+				--m_size;
+			}
+		}
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_URL_TABLE_HPP */
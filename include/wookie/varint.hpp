@@ -0,0 +1,57 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_VARINT_HPP
+#define __WOOKIE_VARINT_HPP
+
+#include <string>
+
+#include <stdint.h>
+
+namespace ioremap { namespace wookie { namespace varint {
+
+// LEB128: 7 bits per byte starting from the least significant ones,
+// high bit is set in every byte except the last one
+static inline void append(std::string &out, uint64_t value)
+{
+	while (value >= 0x80) {
+		out.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+
+	out.push_back((char)value);
+}
+
+// reads one value at @p and moves @p past it, returns false if data ends in the middle
+// of the value or value does not fit 64 bits
+static inline bool read(const char *&p, const char *end, uint64_t &value)
+{
+	value = 0;
+
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		const unsigned char byte = *p++;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+
+		if (!(byte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+}}} // namespace ioremap::wookie::varint
+
+#endif /* __WOOKIE_VARINT_HPP */
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WOOKIE_WORKER_POOL_HPP
+#define __WOOKIE_WORKER_POOL_HPP
+
+#include "wookie/log.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ioremap { namespace wookie {
+
+// Pool of CPU worker threads with work stealing
+//
+// Every worker has its own task queue, tasks are spread over queues round-robin.
+// Worker takes tasks from the head of its own queue and steals from the tail
+// of other queues when its own is empty.
+//
+// Pool does not reject tasks, instead it reports overload when number of queued tasks
+// reaches @high_watermark, producers are expected to stop generating new work until
+// queue drains (downloader stops starting new requests).
+class worker_pool {
+	public:
+		typedef std::function<void ()> task;
+
+		worker_pool(int threads, size_t high_watermark) :
+		m_high_watermark(high_watermark),
+		m_stop(false),
+		m_queued(0),
+		m_next(0) {
+			if (threads < 1)
+				threads = 1;
+
+			for (int i = 0; i < threads; ++i)
+				m_queues.emplace_back(new worker_queue);
+
+			for (int i = 0; i < threads; ++i)
+				m_threads.emplace_back(std::bind(&worker_pool::run, this, i));
+		}
+
+		~worker_pool() {
+			stop();
+		}
+
+		// stops and joins workers, queued tasks and tasks submitted after stop are never run
+		void stop() {
+			{
+				std::unique_lock<std::mutex> guard(m_lock);
+				if (m_stop)
+					return;
+
+				m_stop = true;
+				m_cond.notify_all();
+			}
+
+			for (auto && th : m_threads)
+				th.join();
+		}
+
+		void submit(task &&t) {
+			worker_queue &q = *m_queues[m_next++ % m_queues.size()];
+
+			// counter is incremented before task becomes visible, otherwise worker may pop
+			// and decrement it first and queued() would briefly report negative size
+			++m_queued;
+
+			{
+				std::unique_lock<std::mutex> guard(q.lock);
+				q.tasks.emplace_back(std::move(t));
+			}
+
+			std::unique_lock<std::mutex> guard(m_lock);
+			m_cond.notify_one();
+		}
+
+		bool overloaded() const {
+			return m_queued >= (long)m_high_watermark;
+		}
+
+		size_t queued() const {
+			return m_queued;
+		}
+
+	private:
+		struct worker_queue {
+			std::mutex lock;
+			std::deque<task> tasks;
+		};
+
+		size_t m_high_watermark;
+
+		std::mutex m_lock;
+		std::condition_variable m_cond;
+		bool m_stop;
+
+		std::atomic_long m_queued;
+		std::atomic_ulong m_next;
+
+		std::vector<std::unique_ptr<worker_queue>> m_queues;
+		std::vector<std::thread> m_threads;
+
+		bool pop(size_t idx, task &t) {
+			worker_queue &q = *m_queues[idx];
+
+			std::unique_lock<std::mutex> guard(q.lock);
+			if (q.tasks.empty())
+				return false;
+
+			t = std::move(q.tasks.front());
+			q.tasks.pop_front();
+			return true;
+		}
+
+		bool steal(size_t idx, task &t) {
+			for (size_t i = 1; i < m_queues.size(); ++i) {
+				worker_queue &q = *m_queues[(idx + i) % m_queues.size()];
+
+				std::unique_lock<std::mutex> guard(q.lock);
+				if (q.tasks.empty())
+					continue;
+
+				t = std::move(q.tasks.back());
+				q.tasks.pop_back();
+				return true;
+			}
+
+			return false;
+		}
+
+		void run(size_t idx) {
+			while (true) {
+				task t;
+
+				if (pop(idx, t) || steal(idx, t)) {
+					--m_queued;
+
+					try {
+						t();
+					} catch (const std::exception &e) {
+						WOOKIE_LOG(log_error, "worker pool: task exception: " << e.what());
+					}
+
+					continue;
+				}
+
+				std::unique_lock<std::mutex> guard(m_lock);
+				m_cond.wait(guard, [this] { return m_stop || m_queued > 0; });
+
+				if (m_stop)
+					return;
+			}
+		}
+};
+
+}} // namespace ioremap::wookie
+
+#endif /* __WOOKIE_WORKER_POOL_HPP */
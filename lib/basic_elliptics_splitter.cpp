@@ -15,6 +15,7 @@
  */
 
 #include <wookie/basic_elliptics_splitter.hpp>
+#include <wookie/log.hpp>
 #include <wookie/storage.hpp>
 
 using namespace ioremap;
@@ -29,7 +30,7 @@ void basic_elliptics_splitter::prepare_indexes(const std::string &key, const std
 		std::vector<std::string> tokens;
 		wookie::mpos_t pos = m_splitter.feed(content, tokens);
 
-		std::cout << "split: key: " << key << ", tokens: " << tokens.size() << ", positions: " << pos.size() << std::endl;
+		WOOKIE_LOG(log_debug, "split: key: " << key << ", tokens: " << tokens.size() << ", positions: " << pos.size());
 
 		for (auto && p : pos) {
 			ids.emplace_back(std::move(p.first));
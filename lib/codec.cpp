@@ -0,0 +1,96 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wookie/codec.hpp"
+
+#include <elliptics/cppdef.h>
+
+#include <string.h>
+#include <zlib.h>
+
+namespace ioremap { namespace wookie {
+
+bool encode(document_codec codec, const char *data, size_t size, std::string &out)
+{
+	switch (codec) {
+	case codec_none:
+		out.assign(data, size);
+		return true;
+	case codec_deflate: {
+		// fastest level, HTML is repetitive enough and crawler is bound by CPU
+		uLongf out_size = compressBound(size);
+		out.resize(out_size);
+
+		int err = compress2((Bytef *)&out[0], &out_size, (const Bytef *)data, size, Z_BEST_SPEED);
+		if (err != Z_OK || out_size >= size) {
+			out.clear();
+			return false;
+		}
+
+		out.resize(out_size);
+		return true;
+	}
+	}
+
+	return false;
+}
+
+void check_size(int codec, size_t size, size_t out_size)
+{
+	if (out_size > codec_max_size)
+		elliptics::throw_error(-EPROTO, "codec: decoded size is too large: stored: %zd, expected: %zd, max: %zd",
+				size, out_size, (size_t)codec_max_size);
+
+	switch (codec) {
+	case codec_none:
+		if (size != out_size)
+			elliptics::throw_error(-EPROTO, "codec: body size mismatch: stored: %zd, expected: %zd",
+					size, out_size);
+		return;
+	case codec_deflate:
+		if (out_size / codec_max_ratio > size)
+			elliptics::throw_error(-EPROTO, "codec: decoded size exceeds deflate ratio: stored: %zd, expected: %zd",
+					size, out_size);
+		return;
+	}
+
+	elliptics::throw_error(-EPROTO, "codec: unknown codec %d", codec);
+}
+
+void decode(int codec, const char *data, size_t size, char *out, size_t out_size)
+{
+	check_size(codec, size, out_size);
+
+	switch (codec) {
+	case codec_none:
+		memcpy(out, data, size);
+		return;
+	case codec_deflate: {
+		// inflate has to produce exactly @out_size bytes, shorter output leaves garbage in @out
+		uLongf decoded = out_size;
+
+		int err = uncompress((Bytef *)out, &decoded, (const Bytef *)data, size);
+		if (err != Z_OK || decoded != out_size)
+			elliptics::throw_error(-EPROTO, "codec: corrupted deflate body: zlib error: %d, decoded: %zd, expected: %zd",
+					err, (size_t)decoded, out_size);
+		return;
+	}
+	}
+
+	elliptics::throw_error(-EPROTO, "codec: unknown codec %d", codec);
+}
+
+}} // namespace ioremap::wookie
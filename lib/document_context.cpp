@@ -0,0 +1,186 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wookie/document_context.hpp"
+#include "wookie/parser.hpp"
+#include "wookie/timer.hpp"
+
+#include <boost/algorithm/string.hpp>
+
+namespace ioremap { namespace wookie {
+
+// value of charset parameter starting at @pos in lowercase @text, empty if it is malformed
+static std::string charset_value(const std::string &text, std::string::size_type pos, std::string::size_type end)
+{
+	const char *spaces = " \t\r\n";
+
+	pos = text.find_first_not_of(spaces, pos);
+	if (pos >= end || text[pos] != '=')
+		return std::string();
+
+	pos = text.find_first_not_of(spaces, pos + 1);
+	if (pos >= end)
+		return std::string();
+
+	if (text[pos] == '"' || text[pos] == '\'')
+		++pos;
+
+	std::string::size_type stop = std::min(end, text.find_first_of(" \t\r\n\"';>/", pos));
+	return text.substr(pos, stop - pos);
+}
+
+// charset declared by <meta charset> or <meta http-equiv="content-type" content="...; charset=">,
+// like browsers only the beginning of the document is looked at
+static std::string meta_charset(const std::string &data)
+{
+	const std::string head = boost::algorithm::to_lower_copy(data.substr(0, 1024));
+
+	for (std::string::size_type pos = head.find("<meta"); pos != std::string::npos; pos = head.find("<meta", pos)) {
+		const std::string::size_type end = std::min(head.size(), head.find('>', pos));
+
+		pos = head.find("charset", pos);
+		if (pos >= end) {
+			pos = end;
+			continue;
+		}
+
+		std::string charset = charset_value(head, pos + 7, end);
+		if (!charset.empty())
+			return charset;
+
+		pos = end;
+	}
+
+	return std::string();
+}
+
+document_context::document_context(const swarm::url_fetcher::response &reply, std::string &&data) :
+m_reply(reply),
+m_data(std::move(data)),
+m_parsed(false),
+m_parse_time(0),
+m_charset_ready(false),
+m_text_ready(false),
+m_words_ready(false)
+{
+}
+
+document_context::~document_context()
+{
+}
+
+const swarm::url_fetcher::response &document_context::reply() const
+{
+	return m_reply;
+}
+
+const std::string &document_context::data() const
+{
+	return m_data;
+}
+
+const std::string &document_context::charset()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	if (!m_charset_ready) {
+		if (auto content_type = m_reply.headers().content_type()) {
+			std::string ct = boost::algorithm::to_lower_copy(*content_type);
+
+			std::string::size_type pos = ct.find("charset");
+			if (pos != std::string::npos)
+				m_charset = charset_value(ct, pos + 7, ct.size());
+		}
+
+		// servers often send bare text/html, document declares its charset itself then
+		if (m_charset.empty())
+			m_charset = meta_charset(m_data);
+
+		m_charset_ready = true;
+	}
+
+	return m_charset;
+}
+
+const std::vector<std::string> &document_context::urls()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	return parse().urls();
+}
+
+const std::vector<std::string> &document_context::tokens()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	return parse().tokens();
+}
+
+const std::string &document_context::text()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	if (!m_text_ready) {
+		m_text = parse().text(" ");
+		m_text_ready = true;
+	}
+
+	return m_text;
+}
+
+const std::vector<std::string> &document_context::words()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	if (!m_words_ready) {
+		m_words = parse().word_tokens();
+		m_words_ready = true;
+	}
+
+	return m_words;
+}
+
+wookie::parser &document_context::parser()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	return parse();
+}
+
+int64_t document_context::parse_time() const
+{
+	return m_parse_time;
+}
+
+wookie::parser &document_context::parse()
+{
+	if (!m_parsed) {
+		m_parsed = true;
+
+		wookie::timer tm;
+		try {
+			m_parser.reset(new wookie::parser);
+			m_parser->feed_text(m_data);
+		} catch (...) {
+			m_parse_error = std::current_exception();
+		}
+		m_parse_time = tm.elapsed_us();
+	}
+
+	if (m_parse_error)
+		std::rethrow_exception(m_parse_error);
+
+	return *m_parser;
+}
+
+}} // namespace ioremap::wookie
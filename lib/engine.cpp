@@ -16,11 +16,21 @@
 
 #include "wookie/engine.hpp"
 #include "wookie/storage.hpp"
+#include "wookie/bloom.hpp"
 #include "wookie/dmanager.hpp"
-#include "wookie/parser.hpp"
+#include "wookie/inflight.hpp"
+#include "wookie/journal.hpp"
 #include "wookie/lexical_cast.hpp"
+#include "wookie/log.hpp"
+#include "wookie/metrics.hpp"
+#include "wookie/recrawl.hpp"
 #include "wookie/url.hpp"
+#include "wookie/url_filter.hpp"
+#include "wookie/url_table.hpp"
+#include "wookie/worker_pool.hpp"
 
+#include <condition_variable>
+#include <map>
 #include <mutex>
 
 #include <boost/algorithm/string.hpp>
@@ -33,19 +43,38 @@ filter_functor create_text_filter()
 	{
 		wookie::magic magic;
 
-		bool check(const swarm::url_fetcher::response &reply, const std::string &data)
+		bool check(document_context &ctx)
 		{
-			if (auto content_type = reply.headers().content_type()) {
-				std::cout << *content_type << std::endl;
+			if (auto content_type = ctx.reply().headers().content_type()) {
+				WOOKIE_LOG(log_debug, "Content-Type: " << *content_type);
 
 				return content_type->compare(0, 5, "text/", 5) == 0;
 			} else {
-				return magic.is_text(data.c_str(), data.size());
+				// type is detected by the beginning of the document
+				return magic.is_text(ctx.data().c_str(), std::min<size_t>(ctx.data().size(), 4096));
 			}
 		}
 	};
 
-	return std::bind(&filter::check, std::make_shared<filter>(), std::placeholders::_1, std::placeholders::_2);
+	return std::bind(&filter::check, std::make_shared<filter>(), std::placeholders::_1);
+}
+
+header_filter_functor create_text_header_filter(size_t max_content_length)
+{
+	return [max_content_length] (const swarm::url_fetcher::response &reply) {
+		if (auto content_type = reply.headers().content_type()) {
+			if (content_type->compare(0, 5, "text/", 5) != 0)
+				return false;
+		}
+
+		if (max_content_length) {
+			auto size = reply.headers().content_length();
+			if (size && *size > max_content_length)
+				return false;
+		}
+
+		return true;
+	};
 }
 
 url_filter_functor create_domain_filter(const std::string &url)
@@ -95,14 +124,9 @@ parser_functor create_href_parser()
 {
 	struct parser
 	{
-		std::vector<std::string> operator() (const swarm::url_fetcher::response &reply, const std::string &data)
+		std::vector<std::string> operator() (document_context &ctx)
 		{
-			(void) reply;
-
-			wookie::parser p;
-			p.feed_text(data);
-
-			return p.urls();
+			return ctx.urls();
 		}
 	};
 
@@ -115,202 +139,943 @@ public:
 	std::vector<boost::program_options::options_description> options;
 	std::vector<parser_functor> parsers;
 	std::vector<filter_functor> filters;
+	std::vector<header_filter_functor> header_filters;
+	std::unique_ptr<wookie::url_matcher> url_matcher;
 	std::vector<url_filter_functor> url_filters;
 	std::vector<process_functor> processors;
 	std::vector<process_functor> fallback_processors;
 	std::unique_ptr<wookie::storage> storage;
+
+	// must outlive downloader and processing pool, they record into it
+	wookie::metrics metrics;
+
+	// URLs held by downloader, processing pool and storage callbacks, must outlive them as well
+	wookie::url_table urls;
+	wookie::counter &urls_processed;
+	wookie::counter &not_modified;
+	wookie::counter &page_cache_hits;
+	wookie::counter &page_cache_misses;
+	wookie::counter &near_duplicates;
+	wookie::counter &frontier_dropped;
+	wookie::counter &write_errors;
+	wookie::counter &header_rejected;
+	wookie::counter &page_cache_refetched;
+	wookie::counter &page_cache_skipped;
+	wookie::counter &pages_changed;
+	wookie::counter &pages_unchanged;
+	wookie::histogram &processing_time;
+	wookie::histogram &filter_time;
+	wookie::histogram &parse_time;
+	wookie::histogram &dedup_time;
+	wookie::histogram &page_cache_time;
+	wookie::histogram &storage_write_time;
+
+	// replies are parsed and processed here, not in downloader threads
+	std::unique_ptr<wookie::worker_pool> processing;
 	std::unique_ptr<wookie::dmanager> downloader;
 	boost::program_options::options_description command_line_options;
 
-	std::mutex inflight_lock;
-	std::map<std::string, document> inflight;
+	wookie::inflight_registry inflight;
+
+	// URLs which have been already handled in this generation, they are neither
+	// looked up in page cache nor downloaded again
+	std::unique_ptr<wookie::bloom_filter> seen;
+	std::string seen_path;
+
+	// crawl checkpoint, records accepted and completed URLs
+	std::unique_ptr<wookie::journal> journal;
 
 	std::atomic_long total;
+
+	// outstanding storage writes window
+	std::mutex writes_lock;
+	std::condition_variable writes_cond;
+	long writes_outstanding;
+	long writes_limit;
+
+	// outstanding page cache reads, their completions use engine data as well,
+	// no new reads are started and no new URLs are queued for download once @stopping is set
+	std::mutex reads_lock;
+	std::condition_variable reads_cond;
+	long reads_outstanding;
+	std::atomic<bool> stopping;
 	wookie::magic magic;
 
 	struct dnet_time generation_time;
 
-	engine_data() : total(0) {
+	// seen URLs filter is saved with this value and is valid only in the same generation
+	uint64_t generation_tag() const {
+		return generation_time.tsec * 1000000000ULL + generation_time.tnsec;
+	}
+
+	// maximum number of different fingerprint bits for documents to be near duplicates,
+	// negative value disables duplicate detection
+	int dedup_distance;
+	long dedup_timeout;
+
+	// in recrawl mode page cache documents are refetched when their change history says
+	// they are due, otherwise when they were stored before current generation started
+	bool recrawl_mode;
+	wookie::recrawl_policy recrawl;
+
+	// periodic metrics snapshot and optional HTTP endpoint, they sample members above
+	std::unique_ptr<wookie::metrics_dumper> metrics_dump;
+	std::unique_ptr<wookie::metrics_server> metrics_http;
+
+	engine_data() :
+	urls_processed(metrics.get_counter("urls_processed")),
+	not_modified(metrics.get_counter("not_modified")),
+	page_cache_hits(metrics.get_counter("page_cache_hits")),
+	page_cache_misses(metrics.get_counter("page_cache_misses")),
+	near_duplicates(metrics.get_counter("near_duplicates")),
+	frontier_dropped(metrics.get_counter("frontier_dropped")),
+	write_errors(metrics.get_counter("storage_write_errors")),
+	header_rejected(metrics.get_counter("header_rejected")),
+	page_cache_refetched(metrics.get_counter("page_cache_refetched")),
+	page_cache_skipped(metrics.get_counter("page_cache_skipped")),
+	pages_changed(metrics.get_counter("pages_changed")),
+	pages_unchanged(metrics.get_counter("pages_unchanged")),
+	processing_time(metrics.get_histogram("processing_time")),
+	filter_time(metrics.get_histogram("filter_time")),
+	parse_time(metrics.get_histogram("parse_time")),
+	dedup_time(metrics.get_histogram("dedup_time")),
+	page_cache_time(metrics.get_histogram("page_cache_time")),
+	storage_write_time(metrics.get_histogram("storage_write_time")),
+	total(0), writes_outstanding(0), writes_limit(64), reads_outstanding(0), stopping(false),
+	dedup_distance(simhash::bands - 1),
+	dedup_timeout(200),
+	recrawl_mode(false), recrawl(3600, 30 * 24 * 3600) {
 		dnet_current_time(&generation_time);
 	}
 
-	void download(const swarm::url &url) {
-		std::cout << "Downloading ... " << url.to_string() << std::endl;
-		using namespace std::placeholders;
-		downloader->feed(url, std::bind(&engine_data::process_url, this, _1, _2, _3));
+	~engine_data() {
+		metrics_http.reset();
+		metrics_dump.reset();
+
+		{
+			std::unique_lock<std::mutex> guard(reads_lock);
+			stopping = true;
+		}
+
+		// downloaders and page cache callbacks may still submit replies, they will be dropped
+		if (processing)
+			processing->stop();
+
+		// storage completions issued so far refer to members below, they have to fire
+		// before anything is destroyed, URLs they leave unfinished stay pending in journal
+		{
+			std::unique_lock<std::mutex> guard(reads_lock);
+			reads_cond.wait(guard, [this] { return reads_outstanding == 0; });
+		}
+		{
+			std::unique_lock<std::mutex> guard(writes_lock);
+			writes_cond.wait(guard, [this] { return writes_outstanding == 0; });
+		}
+
+		// index updates queued by processors are written while metrics they record into still exist
+		if (storage)
+			storage->indexer().flush();
 	}
 
-	void found_in_page_cache(const swarm::url &url, const document &doc) {
-		std::cout << "Downloading (if-modified-since " << doc.ts << ") ... " << url.to_string() << std::endl;
-		inflight_insert(url, doc);
-		using namespace std::placeholders;
-		downloader->feed(url, doc, std::bind(&engine_data::process_url, this, _1, _2, _3));
+	// runs header filters when headers arrive, body of rejected reply is discarded as it is received,
+	// body of accepted reply is collected and moved through processing without copies
+	// @depth - link depth of requested URL, links found in the reply are one level deeper
+	class filtered_stream : public buffered_stream {
+		public:
+			filtered_stream(engine_data *engine, int depth) :
+			buffered_stream(std::bind(&engine_data::process_url, engine,
+						std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, depth)),
+			m_engine(engine),
+			m_rejected(false) {
+			}
+
+			virtual bool on_headers(const swarm::url_fetcher::response &reply) {
+				// not modified page has been accepted when it was downloaded
+				if (reply.code() != swarm::url_fetcher::response::not_modified) {
+					for (auto && filter : m_engine->header_filters) {
+						if (!filter(reply)) {
+							m_rejected = true;
+							return false;
+						}
+					}
+				}
+
+				return buffered_stream::on_headers(reply);
+			}
+
+			virtual void on_close(const swarm::url_fetcher::response &reply, const boost::system::error_code &error) {
+				if (m_rejected)
+					m_engine->header_filtered(reply);
+				else
+					buffered_stream::on_close(reply, error);
+			}
+
+		private:
+			engine_data *m_engine;
+			bool m_rejected;
+	};
+
+	shared_reply_stream create_reply_stream(int depth) {
+		return std::make_shared<filtered_stream>(this, depth);
 	}
 
-	bool inflight_insert(const swarm::url &url, const document &doc) {
-		const std::string url_string = url.to_string();
+	// requested and final URLs of a reply, interned once when reply arrives
+	struct reply_urls {
+		interned_url request;
+		interned_url target;
+
+		bool redirected() const {
+			return request->id != target->id;
+		}
+	};
 
-		std::unique_lock<std::mutex> guard(inflight_lock);
-		return inflight.insert(std::make_pair(url_string, doc)).second;
+	reply_urls intern_reply(const swarm::url_fetcher::response &reply) {
+		reply_urls ret;
+		ret.request = urls.intern(reply.request().url());
+		ret.target = urls.intern(reply.url());
+		return ret;
 	}
 
-	bool inflight_insert(const swarm::url &url) {
-		return inflight_insert(url, document());
+	// frontier priorities, within the same priority shallower links are downloaded first
+	enum {
+		priority_new = 0,
+		// documents from page cache which have to be refetched, they are already known to be useful
+		priority_refetch,
+		// seeds and URLs resumed from journal
+		priority_seed,
+	};
+
+	// @depth - number of links between seed and @url
+	void download(const interned_url &url, int depth, int priority = priority_new) {
+		// engine is being destroyed, URL stays pending in journal
+		if (stopping)
+			return;
+
+		WOOKIE_LOG(log_info, "Downloading ... " << url->str << ", depth: " << depth);
+		if (!downloader->feed(swarm::url(url->str), create_reply_stream(depth), priority, depth))
+			frontier_full(url);
 	}
 
-	document inflight_erase(const swarm::url &url) {
-		document d;
+	void found_in_page_cache(const interned_url &url, const document &doc, const recrawl_state &st, int depth) {
+		if (stopping)
+			return;
 
-		const std::string url_string = url.to_string();
+		// URL has been claimed by the page cache lookup, its empty entry gets document metadata
+		inflight.update(url->id, doc, st);
 
-		std::unique_lock<std::mutex> guard(inflight_lock);
-		auto check = inflight.find(url_string);
-		if (check != inflight.end()) {
-			d = check->second;
-			inflight.erase(check);
+		// near duplicate alias has no body to reuse on 304, it is fetched unconditionally
+		bool queued;
+		if (doc.key.empty()) {
+			WOOKIE_LOG(log_info, "Downloading ... " << url->str << ", depth: " << depth);
+			queued = downloader->feed(swarm::url(url->str), create_reply_stream(depth), priority_refetch, depth);
+		} else {
+			WOOKIE_LOG(log_info, "Downloading (if-modified-since " << doc.ts << ") ... " << url->str << ", depth: " << depth);
+			queued = downloader->feed(swarm::url(url->str), doc, create_reply_stream(depth), priority_refetch, depth);
 		}
 
-		return d;
+		if (!queued)
+			frontier_full(url);
+	}
+
+	void frontier_full(const interned_url &url) {
+		WOOKIE_LOG(log_error, "Frontier is full, dropping: " << url->str);
+		frontier_dropped.inc();
+		inflight_erase(url);
+		journal_done(url);
+	}
+
+	void journal_add(const interned_url &url) {
+		if (journal)
+			journal->add(url->id, url->str);
+	}
+
+	void journal_done(const interned_url &url) {
+		if (journal)
+			journal->done(url->id);
+	}
+
+	inflight_registry::entry inflight_erase(const interned_url &url) {
+		inflight_registry::entry e;
+		inflight.erase(url->id, e);
+		return e;
 	}
 
-	ioremap::elliptics::async_write_result store_document(const swarm::url &url, const std::string &content, const dnet_time &ts) {
+	// storage writes issued for one URL, URL is completed in journal when the last of them
+	// has finished and no more writes are going to be issued for it
+	// @left - number of not yet completed writes plus one held by the issuer until write_done()
+	struct write_group {
+		interned_url url;
+		wookie::timer started;
+		std::atomic_int left;
+
+		write_group(const interned_url &url) : url(url), left(1) {
+		}
+	};
+
+	typedef std::shared_ptr<write_group> shared_write_group;
+
+	// document is written together with its metadata record, page cache lookups read only the latter
+	// @hash - recrawl_policy::content_hash() of @content
+	void store_document(const shared_write_group &group, const interned_url &url, const std::string &content, uint64_t hash,
+			const swarm::url_fetcher::response &reply, const dnet_time &ts) {
 		wookie::document d;
 		d.ts = ts;
-		d.key = url.to_string();
+		d.key = url->str;
 		d.data = content;
 
-		return storage->write_document(d);
+		write_acquire();
+		write_issued(group, storage->write_document(d));
+
+		wookie::document_meta meta;
+		meta.ts = ts;
+		meta.size = content.size();
+		meta.content_hash = hash;
+		meta.etag = reply.headers().get("ETag").get_value_or("");
+		meta.status = reply.code();
+
+		write_acquire();
+		write_issued(group, storage->write_document_meta(url->str, meta));
 	}
 
-	void process_reply(const swarm::url_fetcher::response &reply, const std::string &data) {
-		std::cout << "Processing  ... " << reply.request().url().to_string();
-		if (reply.url().to_string() != reply.request().url().to_string())
-			std::cout << " -> " << reply.url().to_string();
+	// returns true if URL has not been seen in this generation and is not being downloaded,
+	// caller becomes responsible for looking it up in page cache or downloading it
+	bool claim_url(const interned_url &url) {
+		if (!seen->insert(url->id))
+			return false;
 
-		std::cout << ", code: " << reply.code() <<
-			     ", total-urls: " << total <<
-			     ", data-size: " << data.size() <<
-			     ", headers: " << reply.headers().all().size() <<
-			     std::endl;
+		if (!inflight.insert(url->id))
+			return false;
 
-		bool accepted_by_filters = true;
-		for (auto it = filters.begin(); accepted_by_filters && it != filters.end(); ++it) {
-			accepted_by_filters &= (*it)(reply, data);
+		journal_add(url);
+		return true;
+	}
+
+	// @duplicate - @target is near duplicate of @url content, not the location @url redirects to
+	void store_alias(const shared_write_group &group, const interned_url &url, const std::string &target, const dnet_time &ts,
+			bool duplicate = false) {
+		wookie::document_alias alias;
+		alias.ts = ts;
+		alias.target = target;
+
+		write_acquire();
+		write_issued(group, storage->write_alias(url->str, alias));
+
+		wookie::document_meta meta;
+		meta.ts = ts;
+		meta.alias = true;
+		meta.duplicate = duplicate;
+		meta.target = target;
+
+		write_acquire();
+		write_issued(group, storage->write_document_meta(url->str, meta));
+	}
+
+	void store_recrawl_state(const shared_write_group &group, const interned_url &url, const recrawl_state &st) {
+		write_acquire();
+		write_issued(group, storage->write_recrawl_state(url->str, st));
+	}
+
+	// blocks until number of outstanding storage writes drops below the limit
+	void write_acquire() {
+		std::unique_lock<std::mutex> guard(writes_lock);
+		while (writes_outstanding >= writes_limit)
+			writes_cond.wait(guard);
+
+		++writes_outstanding;
+	}
+
+	void write_release() {
+		std::unique_lock<std::mutex> guard(writes_lock);
+		--writes_outstanding;
+		writes_cond.notify_all();
+	}
+
+	bool writes_full() {
+		std::unique_lock<std::mutex> guard(writes_lock);
+		return writes_outstanding >= writes_limit;
+	}
+
+	// must be called before page cache read is issued, returns false if engine is being destroyed
+	// and read must not be started, completion of started read ends it with scoped_read
+	bool read_begin() {
+		std::unique_lock<std::mutex> guard(reads_lock);
+		if (stopping)
+			return false;
+
+		++reads_outstanding;
+		return true;
+	}
+
+	void read_end() {
+		std::unique_lock<std::mutex> guard(reads_lock);
+		if (--reads_outstanding == 0)
+			reads_cond.notify_all();
+	}
+
+	struct scoped_read {
+		engine_data *engine;
+
+		~scoped_read() {
+			engine->read_end();
 		}
+	};
 
-		++total;
-		std::list<ioremap::elliptics::async_write_result> res;
+	// write slot taken by write_acquire() is released as soon as this write completes,
+	// so reply which issues several writes never waits for slots it holds itself
+	void write_issued(const shared_write_group &group, async_write_result &&result) {
+		++group->left;
 
-		struct dnet_time ts;
-		dnet_current_time(&ts);
+		using namespace std::placeholders;
+		result.connect(std::bind(&engine_data::write_completed, this, group, _1, _2));
+	}
 
-		res.emplace_back(store_document(reply.url(), data, ts));
+	// called by the issuer when all writes of @group have been issued
+	void write_done(const shared_write_group &group) {
+		if (--group->left == 0)
+			journal_done(group->url);
+	}
 
-		// if original URL redirected to other location, store object by original URL too
-		if (reply.url().to_string() != reply.request().url().to_string())
-			res.emplace_back(store_document(reply.request().url(), data, ts));
+	void write_completed(const shared_write_group &group, const sync_write_result &, const elliptics::error_info &error) {
+		write_release();
+		storage_write_time.observe(group->started.elapsed_us());
 
-		if (accepted_by_filters) {
-			if (reply.code() != ioremap::swarm::url_fetcher::response::not_modified) {
-				for (auto it = processors.begin(); it != processors.end(); ++it)
-					(*it)(reply, data, document_new);
-			}
+		if (error) {
+			write_errors.inc();
+			WOOKIE_LOG(log_error, "Document storage error: " << group->url->str << " " << error.message() <<
+				", total-errors: " << write_errors.value());
+		}
+
+		write_done(group);
+	}
 
-			std::vector<std::string> urls;
+	// returns key of already stored document whose fingerprint differs from this one
+	// in at most @dedup_distance bits, otherwise adds document into fingerprint index
+	// and returns empty string, lookup which does not complete in @dedup_timeout milliseconds
+	// is treated as no match, it runs in pool worker and must not stall processing
+	std::string find_near_duplicate(document_context &ctx, const interned_url &url) {
+		if (dedup_distance < 0)
+			return std::string();
+
+		wookie::scoped_timer tm(dedup_time);
+
+		uint64_t fp;
+		try {
+			fp = simhash::fingerprint(ctx.words());
+		} catch (const std::exception &) {
+			return std::string();
+		}
+
+		if (!fp)
+			return std::string();
+
+		const std::string &key = url->str;
+
+		auto result = storage->find_fingerprints(fp);
+		if (!result.wait_for(std::chrono::milliseconds(dedup_timeout))) {
+			WOOKIE_LOG(log_error, "Near duplicate lookup timed out: url: " << key << ", timeout: " << dedup_timeout << " ms");
+		} else if (!result.error()) {
+			for (auto && entry : result.get()) {
+				for (auto && index : entry.indexes) {
+					try {
+						msgpack::unpacked msg;
+						msgpack::unpack(&msg, index.data.data<char>(), index.data.size());
+
+						simhash::fingerprint_data fd;
+						msg.get().convert(&fd);
 
-			for (auto it = parsers.begin(); it != parsers.end(); ++it) {
-				const auto new_urls = (*it)(reply, data);
-				urls.insert(urls.end(), new_urls.begin(), new_urls.end());
+						if (fd.key != key && simhash::distance(fd.fp, fp) <= dedup_distance)
+							return fd.key;
+					} catch (const std::exception &) {
+					}
+				}
 			}
+		}
+
+		storage->add_fingerprint(key, fp);
+		return std::string();
+	}
 
-			std::sort(urls.begin(), urls.end());
-			urls.erase(std::unique(urls.begin(), urls.end()), urls.end());
+	struct raw_id_less {
+		bool operator() (const dnet_raw_id &a, const dnet_raw_id &b) const {
+			return memcmp(a.id, b.id, DNET_ID_SIZE) < 0;
+		}
+	};
 
-			const swarm::url &base_url = reply.url();
+	typedef std::map<dnet_raw_id, interned_url, raw_id_less> id_to_url_map_t;
 
-			for (auto it = urls.begin(); it != urls.end(); ++it) {
-				swarm::url relative_url = *it;
-				if (!relative_url.is_valid()) {
-					continue;
+	// state of the single bulk page cache read issued for all links found in one page
+	// @pending - links which have not been found in page cache yet, they will be downloaded
+	//	when bulk read completes
+	// @depth - link depth of all links in the batch
+	struct page_cache_batch {
+		std::mutex lock;
+		id_to_url_map_t pending;
+
+		shared_document_context ctx;
+		int depth;
+
+		page_cache_batch(const shared_document_context &ctx, int depth) : ctx(ctx), depth(depth) {
+		}
+	};
+
+	void page_cache_lookup(const shared_document_context &ctx, const std::vector<interned_url> &links, int depth) {
+		if (links.empty() || !read_begin())
+			return;
+
+		auto batch = std::make_shared<page_cache_batch>(ctx, depth);
+
+		// storage keys are the only place where URL strings are needed
+		std::vector<std::string> keys;
+		keys.reserve(links.size());
+		for (auto && url : links)
+			keys.push_back(url->str);
+
+		std::vector<dnet_raw_id> ids = storage->transform_meta_keys(keys);
+		for (size_t i = 0; i < links.size(); ++i)
+			batch->pending[ids[i]] = links[i];
+
+		// only metadata records are read, document bodies stay in storage
+		using namespace std::placeholders;
+		storage->bulk_read_document_meta(keys).connect(
+				std::bind(&engine_data::page_cache_entry, this, batch, _1),
+				std::bind(&engine_data::page_cache_complete, this, batch, wookie::timer(), _1));
+	}
+
+	void page_cache_entry(const std::shared_ptr<page_cache_batch> &batch, const read_entry &entry) {
+		interned_url url;
+		{
+			std::unique_lock<std::mutex> guard(batch->lock);
+			auto it = batch->pending.find(entry.id);
+			if (it == batch->pending.end())
+				return;
+
+			url = it->second;
+			batch->pending.erase(it);
+		}
+
+		page_cache_hits.inc();
+
+		document doc;
+		try {
+			const document_meta meta = storage::unpack_document_meta(entry.data);
+
+			// URL which has been redirected is not fetched again, its target is checked instead,
+			// near duplicate may change, it also follows the usual freshness rules below
+			if (meta.alias) {
+				const document_alias alias = meta.to_alias();
+
+				// URL rejected by header filters in this generation is not fetched again
+				if (alias.rejected()) {
+					if (dnet_time_before(&alias.ts, &generation_time)) {
+						download(url, batch->depth);
+					} else {
+						WOOKIE_LOG(log_info, "Url has been rejected by header filters: url: " << url->str);
+						journal_done(url);
+					}
+					return;
 				}
 
-				swarm::url request_url = base_url.resolved(relative_url);
-				if (!request_url.is_valid()) {
-					continue;
+				WOOKIE_LOG(log_info, "Url has been found in page cache as alias: url: " << url->str <<
+					" -> " << alias.target);
+
+				interned_url target = urls.intern(alias.target);
+				if (claim_url(target))
+					page_cache_lookup(batch->ctx, std::vector<interned_url>(1, target), batch->depth);
+
+				if (!meta.duplicate) {
+					journal_done(url);
+					return;
 				}
+			}
 
-				// We support only http requests
-				if (request_url.scheme() != "https" && request_url.scheme() != "http") {
-					continue;
+			// only timestamp and key are needed to refetch document, document is stored under the same key,
+			// near duplicate alias has no document of its own
+			doc.ts = meta.ts;
+			if (!meta.alias)
+				doc.key = url->str;
+		} catch (const std::exception &e) {
+			WOOKIE_LOG(log_error, "Page cache error (download from internet): url: " << url->str <<
+				", error: " << e.what());
+			download(url, batch->depth);
+			return;
+		}
+
+		if (!read_begin())
+			return;
+
+		using namespace std::placeholders;
+		storage->read_recrawl_state(url->str).connect(
+				std::bind(&engine_data::page_cache_history, this, batch, url, doc, _1, _2));
+	}
+
+	// decides whether document found in page cache has to be refetched,
+	// missing or corrupted change history means URL has never been fetched with history enabled
+	void page_cache_history(const std::shared_ptr<page_cache_batch> &batch, const interned_url &url, const document &doc,
+			const sync_read_result &result, const elliptics::error_info &error) {
+		scoped_read read{this};
+
+		recrawl_state st;
+		if (!error && !result.empty()) {
+			try {
+				st = storage::unpack_recrawl_state(result[0].data);
+			} catch (const std::exception &e) {
+				WOOKIE_LOG(log_error, "Recrawl history is corrupted: url: " << url->str << ", error: " << e.what());
+			}
+		}
+
+		int will_process;
+		if (recrawl_mode) {
+			dnet_time now;
+			dnet_current_time(&now);
+
+			will_process = recrawl.is_due(st, url->id, now);
+			WOOKIE_LOG(log_info, "Url has been found in page cache: url: " << url->str <<
+				", checks: " << st.checks << ", changes: " << st.changes <<
+				", interval: " << st.interval << ", will process (recrawl is due): " << will_process);
+		} else {
+			// document was stored before we started this update generation, process it again
+			will_process = dnet_time_before(&doc.ts, &generation_time);
+			WOOKIE_LOG(log_info, "Url has been found in page cache: url: " << url->str <<
+				", will process (document was saved before current engine started): " << will_process);
+		}
+
+		if (will_process) {
+			page_cache_refetched.inc();
+			found_in_page_cache(url, doc, st, batch->depth);
+
+			// this is storage completion thread, processors may block on storage themselves
+			if (batch->ctx->reply().code() != ioremap::swarm::url_fetcher::response::not_modified) {
+				shared_document_context ctx = batch->ctx;
+				processing->submit([this, ctx] () {
+					for (auto it = processors.begin(); it != processors.end(); ++it)
+						(*it)(*ctx, document_cache);
+				});
+			}
+		} else if (recrawl_mode && doc.key.empty()) {
+			// near duplicate alias has no links of its own, its target has been claimed already
+			page_cache_skipped.inc();
+			journal_done(url);
+		} else if (recrawl_mode) {
+			page_cache_skipped.inc();
+
+			// page itself is not due, but pages it links to may be, otherwise they would be
+			// reachable only when this one is refetched, links are taken from the stored copy
+			if (!read_begin())
+				return;
+
+			using namespace std::placeholders;
+			storage->read_data(url->str).connect(std::bind(&engine_data::process_cached_links, this,
+						url, batch->depth, _1, _2));
+		} else {
+			// page has been stored in this generation, its links have been claimed by then
+			page_cache_skipped.inc();
+			journal_done(url);
+		}
+	}
+
+	void process_cached_links(const interned_url &url, int depth, const sync_read_result &result,
+			const elliptics::error_info &error) {
+		scoped_read read{this};
+
+		if (error || result.empty()) {
+			WOOKIE_LOG(log_error, "Page cache error (links of not due page are not followed): url: " << url->str <<
+				", error: " << error.message());
+			journal_done(url);
+			return;
+		}
+
+		// parsing belongs to processing pool, not to storage thread
+		const elliptics::data_pointer data = result[0].data;
+		processing->submit([this, url, depth, data] () {
+			try {
+				if (!storage::is_alias(data)) {
+					const document_view view = storage::unpack_document_view(data);
+
+					swarm::url_fetcher::response reply;
+					reply.set_url(swarm::url(url->str));
+					reply.set_code(swarm::url_fetcher::response::ok);
+
+					auto ctx = std::make_shared<document_context>(reply, view.body_string());
+
+					bool accepted_by_filters = true;
+					for (auto it = filters.begin(); accepted_by_filters && it != filters.end(); ++it)
+						accepted_by_filters &= (*it)(*ctx);
+
+					if (accepted_by_filters)
+						extract_links(ctx, url, depth + 1);
 				}
+			} catch (const std::exception &e) {
+				WOOKIE_LOG(log_error, "Page cache error (not due page is corrupted): url: " << url->str <<
+					", error: " << e.what());
+			}
+
+			journal_done(url);
+		});
+	}
+
+	void page_cache_complete(const std::shared_ptr<page_cache_batch> &batch, const wookie::timer &started,
+			const elliptics::error_info &error) {
+		scoped_read read{this};
+
+		page_cache_time.observe(started.elapsed_us());
+
+		id_to_url_map_t missed;
+		{
+			std::unique_lock<std::mutex> guard(batch->lock);
+			missed.swap(batch->pending);
+		}
+
+		page_cache_misses.inc(missed.size());
+
+		for (auto it = missed.begin(); it != missed.end(); ++it) {
+			WOOKIE_LOG(log_info, "Page cache error (download from internet): url: " << it->second->str <<
+				", error: " << (error ? error.message() : "not found"));
+			download(it->second, batch->depth);
+		}
+	}
+
+	// claims links of @ctx which pass URL filters and looks them up in page cache,
+	// @target - URL document has been fetched from
+	// @depth - link depth of claimed links
+	void extract_links(const shared_document_context &ctx, const interned_url &target, int depth) {
+		std::vector<std::string> links;
+
+		for (auto it = parsers.begin(); it != parsers.end(); ++it) {
+			const auto new_urls = (*it)(*ctx);
+			links.insert(links.end(), new_urls.begin(), new_urls.end());
+		}
+
+		std::sort(links.begin(), links.end());
+		links.erase(std::unique(links.begin(), links.end()), links.end());
 
-				// Skip invalid and the same urls
-				if (request_url.host().empty() || request_url.to_string() == reply.url().to_string())
+		const swarm::url_fetcher::response &reply = ctx->reply();
+		const swarm::url &base_url = reply.url();
+		std::vector<interned_url> candidates;
+
+		for (auto it = links.begin(); it != links.end(); ++it) {
+			swarm::url relative_url = *it;
+			if (!relative_url.is_valid()) {
+				continue;
+			}
+
+			swarm::url request_url = base_url.resolved(relative_url);
+			if (!request_url.is_valid()) {
+				continue;
+			}
+
+			// We support only http requests
+			if (request_url.scheme() != "https" && request_url.scheme() != "http") {
+				continue;
+			}
+
+			if (request_url.host().empty())
+				continue;
+
+			// link is serialized and hashed once here, everything below works with its id
+			const interned_url link = urls.intern(request_url);
+
+			// Skip the same url
+			if (link->id == target->id)
+				continue;
+
+			// compiled filter checks absolute URL in one pass, custom functors are called
+			// only for links which passed it
+			if (url_matcher) {
+				const auto port = request_url.port();
+				if (!url_matcher->check(request_url.host(), port ? *port : 0, link->str))
 					continue;
+			}
 
-				// Check by user filters
-				bool ok = true;
-				for (auto jt = url_filters.begin(); ok && jt != url_filters.end(); ++jt) {
-					ok &= (*jt)(reply, *it);
-				}
+			// Check by user filters
+			bool ok = true;
+			for (auto jt = url_filters.begin(); ok && jt != url_filters.end(); ++jt) {
+				ok &= (*jt)(reply, *it);
+			}
 
-				if (ok) {
-					if (!inflight_insert(request_url))
-						continue;
+			if (ok && claim_url(link))
+				candidates.emplace_back(link);
+		}
 
-					auto rres = storage->read_data(request_url.to_string());
-					rres.wait();
-					if (rres.error().code()) {
-						std::cout << "Page cache error (download from internet): url: " << request_url.to_string() <<
-							", error: " << rres.error().message() << std::endl;
-						download(request_url);
-					} else {
-						document doc = storage::unpack_document(rres.get_one().file());
-						// document was stored before we started this update generation, process it again
-						int will_process = dnet_time_before(&doc.ts, &generation_time);
-						std::cout << "Url has been found in page cache: url: " << request_url.to_string() <<
-							", will process (document was saved before current engine started): " << will_process <<
-							std::endl;
-
-						if (will_process) {
-							found_in_page_cache(request_url, doc);
-
-							if (reply.code() != ioremap::swarm::url_fetcher::response::not_modified) {
-								for (auto it = processors.begin(); it != processors.end(); ++it)
-									(*it)(reply, data, document_cache);
-							}
-						}
-					}
-				}
+		page_cache_lookup(ctx, candidates, depth);
+	}
+
+	// @history - change history of the requested URL before this fetch
+	// @depth - link depth of the requested URL
+	void process_reply(const swarm::url_fetcher::response &reply, const reply_urls &ids, std::string &&content,
+			const recrawl_state &history, int depth) {
+		// document is parsed at most once and shared by all parsers, filters and processors,
+		// page cache lookup holds it until all links have been checked
+		wookie::scoped_timer processing_tm(processing_time);
+
+		auto ctx = std::make_shared<document_context>(reply, std::move(content));
+		const std::string &data = ctx->data();
+
+		WOOKIE_LOG(log_info, "Processing  ... " << ids.request->str <<
+			     (ids.redirected() ? " -> " + ids.target->str : "") <<
+			     ", code: " << reply.code() <<
+			     ", total-urls: " << total <<
+			     ", data-size: " << data.size() <<
+			     ", headers: " << reply.headers().all().size());
+
+		bool accepted_by_filters = true;
+		{
+			wookie::scoped_timer tm(filter_time);
+			for (auto it = filters.begin(); accepted_by_filters && it != filters.end(); ++it) {
+				accepted_by_filters &= (*it)(*ctx);
 			}
+		}
+
+		++total;
+		urls_processed.inc();
+
+		struct dnet_time ts;
+		dnet_current_time(&ts);
+
+		const uint64_t content_hash = recrawl_policy::content_hash(data);
+
+		std::string duplicate_of;
+		if (accepted_by_filters && reply.code() != ioremap::swarm::url_fetcher::response::not_modified)
+			duplicate_of = find_near_duplicate(*ctx, ids.target);
+
+		auto writes = std::make_shared<write_group>(ids.request);
+		if (duplicate_of.empty()) {
+			store_document(writes, ids.target, data, content_hash, reply, ts);
+
+			// if original URL redirected to other location, store alias to the final location by original URL
+			if (ids.redirected())
+				store_alias(writes, ids.request, ids.target->str, ts);
 		} else {
-			for (auto it = fallback_processors.begin(); it != fallback_processors.end(); ++it)
-				(*it)(reply, data, document_new);
+			WOOKIE_LOG(log_info, "Near duplicate ... " << ids.target->str << " -> " << duplicate_of);
+			near_duplicates.inc();
+
+			store_alias(writes, ids.target, duplicate_of, ts, true);
+			if (ids.redirected())
+				store_alias(writes, ids.request, duplicate_of, ts, true);
 		}
 
-		for (auto && r : res) {
-			r.wait();
-			if (r.error()) {
-				std::cout << "Document storage error: " << reply.request().url().to_string() << " " << r.error().message() << std::endl;
+		// near duplicates are neither processed nor parsed for links,
+		// this also stops crawling session-id and similar URL traps
+		if (accepted_by_filters && duplicate_of.empty()) {
+			if (reply.code() != ioremap::swarm::url_fetcher::response::not_modified) {
+				for (auto it = processors.begin(); it != processors.end(); ++it)
+					(*it)(*ctx, document_new);
 			}
+
+			extract_links(ctx, ids.target, depth + 1);
+		} else if (!accepted_by_filters) {
+			for (auto it = fallback_processors.begin(); it != fallback_processors.end(); ++it)
+				(*it)(*ctx, document_new);
 		}
+
+		// every fetch is accounted in change history, redirect target shares history with requested URL
+		recrawl_state st = history;
+		recrawl.update(st, content_hash, reply.code() == ioremap::swarm::url_fetcher::response::not_modified, ts);
+		if (history.known())
+			(st.changes != history.changes ? pages_changed : pages_unchanged).inc();
+
+		store_recrawl_state(writes, ids.request, st);
+		if (ids.redirected())
+			store_recrawl_state(writes, ids.target, st);
+
+		// parsing is lazy, it has happened by now if anyone needed parsed document
+		if (ctx->parse_time())
+			parse_time.observe(ctx->parse_time());
+
+		// writes complete asynchronously, links found in this page have already been recorded in journal
+		write_done(writes);
 	}
 
-	void process_url(const swarm::url_fetcher::response &reply, const std::string &data, const boost::system::error_code &error) {
-		document old_doc = inflight_erase(reply.request().url());
+	// called from downloader thread when reply has been rejected by its headers
+	void header_filtered(const swarm::url_fetcher::response &reply) {
+		const reply_urls ids = intern_reply(reply);
+
+		inflight_erase(ids.request);
+		header_rejected.inc();
+
+		WOOKIE_LOG(log_info, "Rejected by headers ... " << ids.request->str <<
+			", code: " << reply.code() <<
+			", content-type: " << reply.headers().content_type().get_value_or(""));
+
+		// negative entry is stored from processing pool, storage writes window may block
+		processing->submit([this, ids] () {
+			struct dnet_time ts;
+			dnet_current_time(&ts);
+
+			auto writes = std::make_shared<write_group>(ids.request);
+			store_alias(writes, ids.request, std::string(), ts);
+			if (ids.redirected())
+				store_alias(writes, ids.target, std::string(), ts);
+
+			write_done(writes);
+		});
+	}
+
+	void process_url(const swarm::url_fetcher::response &reply, std::string &&data, const boost::system::error_code &error,
+			int depth) {
+		const reply_urls ids = intern_reply(reply);
+		inflight_registry::entry old_doc = inflight_erase(ids.request);
 
 		if (error) {
-			std::cout << "Error  ... " << reply.request().url().to_string();
-			if (reply.url().to_string() != reply.request().url().to_string())
-				std::cout << " -> " << reply.url().to_string();
-			std::cout << ": " << error.message() << std::endl;
+			WOOKIE_LOG(log_error, "Error  ... " << ids.request->str <<
+				(ids.redirected() ? " -> " + ids.target->str : "") <<
+				": " << error.message());
+			journal_done(ids.request);
 			return;
 		}
 
+		if (reply.code() == ioremap::swarm::url_fetcher::response::not_modified)
+			not_modified.inc();
+
 		if (reply.code() != ioremap::swarm::url_fetcher::response::not_modified) {
-			process_reply(reply, data);
+			submit_reply(reply, ids, std::move(data), old_doc.recrawl, depth);
 		} else {
-			process_reply(reply, old_doc.data);
+			// inflight registry does not hold document bodies, reread not modified page from page cache,
+			// it is looked up by URL if registry does not know its key, 304 is never stored without body
+			const std::string key = old_doc.cached() ? old_doc.key : ids.request->str;
+
+			if (!read_begin())
+				return;
+
+			using namespace std::placeholders;
+			storage->read_data(key).connect(std::bind(&engine_data::process_not_modified, this,
+						reply, ids, old_doc.recrawl, depth, _1, _2));
+		}
+	}
+
+	// hands reply over to processing pool, caller (downloader or storage thread) does not wait for it
+	void submit_reply(const swarm::url_fetcher::response &reply, const reply_urls &ids, std::string &&data,
+			const recrawl_state &history, int depth) {
+		auto content = std::make_shared<std::string>(std::move(data));
+		processing->submit([this, reply, ids, content, history, depth] () {
+			process_reply(reply, ids, std::move(*content), history, depth);
+		});
+	}
+
+	void process_not_modified(const swarm::url_fetcher::response &reply, const reply_urls &ids, const recrawl_state &history,
+			int depth, const sync_read_result &result, const elliptics::error_info &error) {
+		scoped_read read{this};
+
+		if (error || result.empty()) {
+			WOOKIE_LOG(log_error, "Page cache error (not modified page has gone): url: " << ids.request->str <<
+				", error: " << error.message());
+			journal_done(ids.request);
+			return;
+		}
+
+		try {
+			if (storage::is_alias(result[0].data)) {
+				WOOKIE_LOG(log_info, "Not modified near duplicate, skipping: url: " << ids.request->str);
+				journal_done(ids.request);
+				return;
+			}
+
+			// body is decoded once, straight from the read buffer into the string processing owns
+			const document_view view = storage::unpack_document_view(result[0].data);
+			submit_reply(reply, ids, view.body_string(), history, depth);
+		} catch (const std::exception &e) {
+			WOOKIE_LOG(log_error, "Page cache error (not modified page is corrupted): url: " << ids.request->str <<
+				", error: " << e.what());
+			journal_done(ids.request);
 		}
 	}
 };
@@ -328,6 +1093,11 @@ storage *engine::get_storage()
 	return m_data->storage.get();
 }
 
+metrics &engine::get_metrics()
+{
+	return m_data->metrics;
+}
+
 void engine::add_options(const boost::program_options::options_description &description)
 {
 	m_data->options.push_back(description);
@@ -350,6 +1120,16 @@ void engine::add_filter(const filter_functor &filter)
 	m_data->filters.push_back(filter);
 }
 
+void engine::set_url_filter(const url_filter_spec &spec)
+{
+	m_data->url_matcher.reset(new wookie::url_matcher(spec));
+}
+
+void engine::add_header_filter(const header_filter_functor &filter)
+{
+	m_data->header_filters.push_back(filter);
+}
+
 void engine::add_url_filter(const url_filter_functor &filter)
 {
 	m_data->url_filters.push_back(filter);
@@ -380,19 +1160,94 @@ int engine::parse_command_line(int argc, char **argv, boost::program_options::va
 	std::string group_string;
 	std::string log_file;
 	int log_level;
+	std::string engine_log_file;
+	int engine_log_level;
 	std::string remote;
 	std::string ns;
+	std::string backend_type;
+	std::string storage_path;
 	int url_threads_count;
+	int processing_threads_count;
+	long processing_queue_size;
+	long thread_connections;
+	long seen_filter_size;
+	std::string journal_path;
+	long frontier_size;
+	int host_connections;
+	long host_delay;
+	long max_body_size;
+	long recrawl_min_interval;
+	long recrawl_max_interval;
+	long index_batch_size;
+	long index_batch_delay;
+	std::string metrics_file;
+	int metrics_interval;
+	int metrics_port;
 
 	general_options.add_options()
 			("help", "This help message")
 			("log-file", value<std::string>(&log_file)->default_value("/dev/stdout"), "Log file")
 			("log-level", value<int>(&log_level)->default_value(DNET_LOG_ERROR), "Log level")
+			("engine-log-file", value<std::string>(&engine_log_file)->default_value("/dev/stdout"), "Crawler log file")
+			("engine-log-level", value<int>(&engine_log_level)->default_value(log_info),
+			 "Crawler log level: 0 - errors, 1 - per-URL progress, 2 - debug")
 			("groups", value<std::string>(&group_string), "Groups which will host indexes and data, format: 1:2:3")
 			("uthreads", value<int>(&url_threads_count)->default_value(3), "Number of URL downloading and processing threads")
+			("pthreads", value<int>(&processing_threads_count)->default_value(std::max(1U, std::thread::hardware_concurrency())),
+			 "Number of downloaded document processing threads")
+			("storage-writes", value<long>(&m_data->writes_limit)->default_value(64),
+			 "Maximum number of outstanding document storage writes, downloading is paused when it is reached")
+			("processing-queue", value<long>(&processing_queue_size)->default_value(100),
+			 "Number of downloaded documents waiting for processing when downloading is paused")
+			("thread-connections", value<long>(&thread_connections)->default_value(10),
+			 "Maximum number of simultaneous downloads per URL downloading thread")
+			("frontier-size", value<long>(&frontier_size)->default_value(1000000),
+			 "Maximum number of URLs waiting to be downloaded")
+			("host-connections", value<int>(&host_connections)->default_value(2),
+			 "Maximum number of simultaneous downloads from the same host")
+			("host-delay", value<long>(&host_delay)->default_value(0),
+			 "Minimum delay between starting downloads from the same host in milliseconds")
+			("max-body-size", value<long>(&max_body_size)->default_value(16 * 1024 * 1024),
+			 "Maximum size of downloaded document in bytes, larger documents are dropped, 0 means unlimited")
+			("dedup-distance", value<int>(&m_data->dedup_distance)->default_value(simhash::bands - 1),
+			 "Maximum number of different SimHash bits for a page to be stored as near duplicate alias (0-3), "
+			 "negative value disables near duplicate detection")
+			("dedup-timeout", value<long>(&m_data->dedup_timeout)->default_value(200),
+			 "Maximum time to wait for near duplicate lookup in milliseconds, page is stored as is when it expires")
+			("recrawl", "Refetch page cache documents when their change history says they are due, "
+			 "instead of refetching every document stored before current generation")
+			("recrawl-min-interval", value<long>(&recrawl_min_interval)->default_value(3600),
+			 "Minimum interval between fetches of the same URL in recrawl mode in seconds")
+			("recrawl-max-interval", value<long>(&recrawl_max_interval)->default_value(30 * 24 * 3600),
+			 "Maximum interval between fetches of the same URL in recrawl mode in seconds")
 			("namespace", value<std::string>(&ns), "Namespace for urls and indexes")
+			("seen-filter", value<std::string>(&m_data->seen_path),
+			 "File where filter of already crawled URLs is loaded from at start and saved to at exit, "
+			 "it is used only by the crawl generation which saved it, so it needs --journal to be reused")
+			("journal", value<std::string>(&journal_path),
+			 "Crawl journal file, crawl restarted with the same journal continues where it stopped")
+			("seen-filter-size", value<long>(&seen_filter_size)->default_value(10000000),
+			 "Expected number of URLs in crawl, defines seen URLs filter memory footprint. "
+			 "Filter is probabilistic: about 1% of new URLs are taken for already seen and never crawled "
+			 "while crawl stays within this size, more once it grows beyond it")
+			("metrics-file", value<std::string>(&metrics_file),
+			 "File where metrics snapshot is periodically written, it is written into crawler log if not set")
+			("metrics-interval", value<int>(&metrics_interval)->default_value(60),
+			 "Interval between metrics snapshots in seconds, 0 disables them")
+			("metrics-json", "Write metrics snapshot in JSON instead of text")
+			("metrics-port", value<int>(&metrics_port)->default_value(0),
+			 "Serve metrics over HTTP on 127.0.0.1 at this port, GET /metrics.json returns JSON, 0 disables it")
 			("remote", value<std::string>(&remote),
 			 "Remote node to connect, format: address:port:family (IPv4 - 2, IPv6 - 10)")
+			("storage-backend", value<std::string>(&backend_type)->default_value("elliptics"),
+			 "Storage documents and indexes are kept in: elliptics - cluster --remote node belongs to, "
+			 "memory - process memory (lost at exit), file - local directory set by --storage-path")
+			("storage-path", value<std::string>(&storage_path),
+			 "Directory file storage backend keeps documents and indexes in")
+			("index-batch-size", value<long>(&index_batch_size)->default_value(index_writer::default_max_documents),
+			 "Maximum number of documents whose index updates are written together in one batch")
+			("index-batch-delay", value<long>(&index_batch_delay)->default_value(index_writer::default_max_delay_ms),
+			 "Maximum time index update waits for its batch to fill up in milliseconds")
 			;
 
 	m_data->command_line_options.add(general_options);
@@ -402,7 +1257,7 @@ int engine::parse_command_line(int argc, char **argv, boost::program_options::va
 	store(boost::program_options::parse_command_line(argc, argv, m_data->command_line_options), vm);
 	notify(vm);
 
-	if (vm.count("help") || !vm.count("remote")) {
+	if (vm.count("help") || (backend_type == "elliptics" && !vm.count("remote"))) {
 		std::cerr << general_options << std::endl;
 		for (auto it = m_data->options.begin(); it != m_data->options.end(); ++it)
 			std::cerr << *it << std::endl;
@@ -425,40 +1280,182 @@ int engine::parse_command_line(int argc, char **argv, boost::program_options::va
 		std::transform(gr.begin(), gr.end(), std::back_inserter<std::vector<int>>(groups), digitizer());
 	}
 
+	logger::set_level(engine_log_level);
+	if (engine_log_level >= log_error) {
+		try {
+			logger::instance().set_output(engine_log_file);
+		} catch (const std::exception &e) {
+			std::cerr << "Could not open crawler log: " << e.what() << std::endl;
+			return -1;
+		}
+	}
+
 	elliptics::file_logger log(log_file.c_str(), log_level);
-	m_data->storage.reset(new wookie::storage(elliptics::node(log)));
+	m_data->dedup_distance = std::min<int>(m_data->dedup_distance, simhash::bands - 1);
+	m_data->writes_limit = std::max(1L, m_data->writes_limit);
+	m_data->recrawl_mode = vm.count("recrawl") != 0;
+	m_data->recrawl = recrawl_policy(std::max(1L, recrawl_min_interval), std::max(1L, recrawl_max_interval));
+
+	std::unique_ptr<storage_backend> backend;
+	if (backend_type == "elliptics") {
+		std::unique_ptr<elliptics_backend> eb(new elliptics_backend(elliptics::node(log)));
+
+		try {
+			eb->get_node().add_remote(remote.c_str());
+		} catch (const elliptics::error &e) {
+			std::cerr << "Could not connect to " << remote << ": " << e.what() << std::endl;
+			return -1;
+		}
+
+		eb->set_groups(groups);
+		backend = std::move(eb);
+	} else if (backend_type == "memory") {
+		backend.reset(new memory_backend());
+	} else if (backend_type == "file") {
+		if (storage_path.empty()) {
+			std::cerr << "File storage backend requires --storage-path" << std::endl;
+			return -1;
+		}
+
+		try {
+			backend.reset(new file_backend(storage_path));
+		} catch (const std::exception &e) {
+			std::cerr << "Could not open file storage: " << e.what() << std::endl;
+			return -1;
+		}
+	} else {
+		std::cerr << "Unknown storage backend: " << backend_type << std::endl;
+		return -1;
+	}
+
+	m_data->storage.reset(new wookie::storage(std::move(backend)));
 
 	if (ns.size())
 		m_data->storage->set_namespace(ns);
 
-	try {
-		m_data->storage->get_node().add_remote(remote.c_str());
-	} catch (const elliptics::error &e) {
-		std::cerr << "Could not connect to " << remote << ": " << e.what() << std::endl;
-		return -1;
+	m_data->storage->indexer().set_limits(std::max(1L, index_batch_size), index_batch_delay);
+
+	if (journal_path.size()) {
+		try {
+			m_data->journal.reset(new wookie::journal(journal_path));
+		} catch (const std::exception &e) {
+			std::cerr << "Could not open crawl journal: " << e.what() << std::endl;
+			return -1;
+		}
+
+		// continue previous generation, documents it has already stored are not processed again
+		if (!m_data->journal->generation(m_data->generation_time))
+			m_data->journal->set_generation(m_data->generation_time);
 	}
 
-	m_data->storage->set_groups(groups);
+	// URLs seen in other generation have to be crawled again, their filter is dropped
+	m_data->seen.reset(new wookie::bloom_filter(seen_filter_size));
+	if (m_data->seen_path.size()) {
+		try {
+			if (m_data->seen->load(m_data->seen_path, m_data->generation_tag()))
+				WOOKIE_LOG(log_info, "Loaded seen URLs filter: " << m_data->seen_path);
+			else
+				WOOKIE_LOG(log_info, "Seen URLs filter does not exist or belongs to other crawl generation, "
+						"starting with empty one: " << m_data->seen_path);
+		} catch (const std::exception &e) {
+			std::cerr << "Could not load seen URLs filter: " << e.what() << std::endl;
+			return -1;
+		}
+	}
 
-	m_data->downloader.reset(new wookie::dmanager(url_threads_count));
+	m_data->processing.reset(new wookie::worker_pool(processing_threads_count, processing_queue_size));
+
+	m_data->downloader.reset(new wookie::dmanager(url_threads_count, thread_connections,
+				frontier_size, host_connections, host_delay, std::max(0L, max_body_size)));
+	m_data->downloader->set_pause_check([this] () {
+		return m_data->processing->overloaded() || m_data->writes_full();
+	});
+
+	m_data->downloader->set_metrics(m_data->metrics);
+	m_data->metrics.add_gauge("frontier_queued", [this] () { return (long)m_data->downloader->queued(); });
+	m_data->metrics.add_gauge("downloads_active", [this] () { return (long)m_data->downloader->active(); });
+	m_data->metrics.add_gauge("inflight_urls", [this] () { return (long)m_data->inflight.size(); });
+	m_data->metrics.add_gauge("interned_urls", [this] () { return (long)m_data->urls.size(); });
+	m_data->metrics.add_gauge("processing_queued", [this] () { return (long)m_data->processing->queued(); });
+	m_data->metrics.add_gauge("storage_writes_outstanding", [this] () {
+		std::unique_lock<std::mutex> guard(m_data->writes_lock);
+		return m_data->writes_outstanding;
+	});
+	m_data->metrics.add_gauge("log_dropped", [] () { return logger::instance().dropped(); });
+
+	if (metrics_interval > 0)
+		m_data->metrics_dump.reset(new wookie::metrics_dumper(m_data->metrics, metrics_file,
+					metrics_interval, vm.count("metrics-json") != 0));
+
+	if (metrics_port > 0) {
+		try {
+			m_data->metrics_http.reset(new wookie::metrics_server(m_data->metrics, metrics_port));
+		} catch (const std::exception &e) {
+			std::cerr << "Could not start metrics server: " << e.what() << std::endl;
+			return -1;
+		}
+	}
 
 	return 0;
 }
 
 void engine::download(const swarm::url &url)
 {
-	m_data->download(url);
+	const interned_url id = m_data->urls.intern(url);
+
+	m_data->seen->insert(id->id);
+	m_data->journal_add(id);
+	m_data->download(id, 0, engine_data::priority_seed);
 }
 
 int engine::run()
 {
+	if (m_data->journal) {
+		long resumed = 0;
+
+		// journal written before URLs were canonicalized may hold pending URLs in other form,
+		// they are completed under their canonical ids, so journal records are moved to them
+		std::vector<std::pair<std::string, interned_url>> renamed;
+
+		m_data->journal->recover([this, &resumed, &renamed] (const std::string &url, bool pending) {
+			const interned_url id = m_data->urls.intern(url);
+			m_data->seen->insert(id->id);
+
+			if (pending && id->str != url)
+				renamed.emplace_back(url, id);
+
+			// journal does not keep link depth, resumed URLs are restarted as seeds
+			if (pending && m_data->inflight.insert(id->id)) {
+				m_data->download(id, 0, engine_data::priority_seed);
+				++resumed;
+			}
+		});
+
+		for (auto && r : renamed) {
+			m_data->journal->done(r.first);
+			m_data->journal_add(r.second);
+		}
+
+		WOOKIE_LOG(log_info, "Crawl journal: resumed urls: " << resumed);
+	}
+
 	m_data->downloader->start();
+
+	if (m_data->seen_path.size()) {
+		try {
+			m_data->seen->save(m_data->seen_path, m_data->generation_tag());
+		} catch (const std::exception &e) {
+			std::cerr << "Could not save seen URLs filter: " << e.what() << std::endl;
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
 void engine::found_in_page_cache(const std::string &url, const document &doc)
 {
-	m_data->found_in_page_cache(url, doc);
+	m_data->found_in_page_cache(m_data->urls.intern(url), doc, recrawl_state(), 0);
 }
 
 }}
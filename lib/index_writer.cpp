@@ -0,0 +1,196 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wookie/index_writer.hpp"
+#include "wookie/log.hpp"
+#include "wookie/storage.hpp"
+
+#include <algorithm>
+
+namespace ioremap { namespace wookie {
+
+index_writer::index_writer(storage &st) :
+m_st(st),
+m_max_documents(default_max_documents),
+m_max_pending(8 * default_max_documents),
+m_max_delay(default_max_delay_ms),
+m_queued(0),
+m_written(0),
+m_flush_target(0),
+m_stop(false)
+{
+}
+
+index_writer::~index_writer()
+{
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+		m_stop = true;
+		m_cond.notify_all();
+	}
+
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void index_writer::set_limits(size_t max_documents, long max_delay_ms)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	m_max_documents = std::max<size_t>(1, max_documents);
+	m_max_pending = 8 * m_max_documents;
+	m_max_delay = std::chrono::milliseconds(std::max(0L, max_delay_ms));
+	m_cond.notify_all();
+}
+
+void index_writer::add(const std::string &key, const std::vector<std::string> &indexes,
+		const std::vector<elliptics::data_pointer> &datas, const completion_handler &handler)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	// writer thread is started by the first update, storages which never index do not need it
+	if (!m_thread.joinable())
+		m_thread = std::thread(std::bind(&index_writer::run, this));
+
+	while (m_pending.size() >= m_max_pending)
+		m_written_cond.wait(guard);
+
+	if (m_pending.empty())
+		m_oldest = std::chrono::steady_clock::now();
+
+	m_pending.push_back(update{key, indexes, datas, handler});
+	++m_queued;
+
+	if (m_pending.size() >= m_max_documents)
+		m_cond.notify_all();
+}
+
+void index_writer::flush()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	if (m_written == m_queued)
+		return;
+
+	m_flush_target = std::max(m_flush_target, m_queued);
+	m_cond.notify_all();
+
+	const uint64_t target = m_queued;
+	while (m_written < target)
+		m_written_cond.wait(guard);
+}
+
+void index_writer::run()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	while (true) {
+		if (m_pending.empty()) {
+			if (m_stop)
+				break;
+
+			m_cond.wait(guard);
+			continue;
+		}
+
+		// batch is not full yet, it waits for more documents unless someone needs it written
+		if (m_pending.size() < m_max_documents && !m_stop && m_flush_target <= m_written) {
+			const auto deadline = m_oldest + m_max_delay;
+			if (std::chrono::steady_clock::now() < deadline) {
+				m_cond.wait_until(guard, deadline);
+				continue;
+			}
+		}
+
+		std::vector<update> batch;
+		batch.swap(m_pending);
+
+		guard.unlock();
+		write(batch);
+		guard.lock();
+
+		m_written += batch.size();
+		m_written_cond.notify_all();
+	}
+}
+
+void index_writer::write(std::vector<update> &batch)
+{
+	std::vector<std::string> tokens;
+	for (auto && u : batch)
+		tokens.insert(tokens.end(), u.indexes.begin(), u.indexes.end());
+
+	std::sort(tokens.begin(), tokens.end());
+	tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+
+	std::vector<index_update> updates(batch.size());
+	try {
+		const std::vector<dnet_raw_id> ids = m_st.terms().ids(tokens);
+
+		for (size_t i = 0; i < batch.size(); ++i) {
+			const update &u = batch[i];
+
+			updates[i].key = u.key;
+			updates[i].indexes.resize(u.indexes.size());
+
+			for (size_t j = 0; j < u.indexes.size(); ++j) {
+				auto it = std::lower_bound(tokens.begin(), tokens.end(), u.indexes[j]);
+
+				updates[i].indexes[j].index = ids[it - tokens.begin()];
+				updates[i].indexes[j].data = u.datas[j];
+			}
+		}
+	} catch (const std::exception &e) {
+		WOOKIE_LOG(log_error, "Index writer: could not prepare batch of " << batch.size() <<
+				" documents: " << e.what());
+
+		const elliptics::error_info error = elliptics::create_error(-EINVAL, "could not prepare index batch: %s", e.what());
+		for (auto && u : batch) {
+			if (u.handler)
+				u.handler(error);
+		}
+		return;
+	}
+
+	std::vector<async_write_result> results = m_st.bulk_set_indexes(updates);
+
+	// every token of the batch, once per document it is found in, term dictionary
+	// accounts them as document frequencies, documents whose indexes were not written are skipped
+	std::vector<std::string> written_tokens;
+
+	size_t errors = 0;
+	for (size_t i = 0; i < batch.size(); ++i) {
+		const elliptics::error_info error = results[i].error();
+		if (error)
+			++errors;
+		else
+			written_tokens.insert(written_tokens.end(), batch[i].indexes.begin(), batch[i].indexes.end());
+
+		if (batch[i].handler)
+			batch[i].handler(error);
+	}
+
+	if (!written_tokens.empty())
+		m_st.terms().add_document(written_tokens);
+
+	if (errors)
+		WOOKIE_LOG(log_error, "Index writer: documents: " << batch.size() << ", tokens: " << tokens.size() <<
+				", errors: " << errors);
+	else
+		WOOKIE_LOG(log_debug, "Index writer: documents: " << batch.size() << ", tokens: " << tokens.size());
+}
+
+}} // namespace ioremap::wookie
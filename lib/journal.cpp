@@ -0,0 +1,277 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wookie/journal.hpp"
+#include "wookie/hash.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace ioremap { namespace wookie {
+
+// journal is not compacted until it contains at least this number of records
+static const size_t journal_compact_min_records = 100000;
+
+static void journal_throw(const std::string &path, const char *what)
+{
+	std::ostringstream ss;
+	ss << "journal: " << what << " '" << path << "': " << strerror(errno);
+	throw std::runtime_error(ss.str());
+}
+
+static uint64_t journal_fingerprint(const char *url, size_t size)
+{
+	return hash::murmur(std::string(url, size), 0);
+}
+
+journal::journal(const std::string &path) :
+m_path(path),
+m_fd(-1),
+m_has_generation(false),
+m_records(0)
+{
+	memset(&m_generation, 0, sizeof(m_generation));
+
+	size_t valid = replay(m_path, [this] (char type, const char *payload, uint32_t size) {
+		++m_records;
+
+		switch (type) {
+		case record_generation:
+			if (size == sizeof(m_generation)) {
+				memcpy(&m_generation, payload, size);
+				m_has_generation = true;
+			}
+			break;
+		case record_add:
+			m_pending.insert(journal_fingerprint(payload, size));
+			break;
+		case record_done:
+			if (size == sizeof(uint64_t)) {
+				uint64_t fp;
+				memcpy(&fp, payload, size);
+				m_pending.erase(fp);
+			}
+			break;
+		}
+	});
+
+	m_fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (m_fd < 0)
+		journal_throw(m_path, "could not open");
+
+	// drop torn record left by crash
+	if (ftruncate(m_fd, valid) < 0) {
+		close(m_fd);
+		journal_throw(m_path, "could not truncate");
+	}
+}
+
+journal::~journal()
+{
+	if (m_fd >= 0) {
+		fdatasync(m_fd);
+		close(m_fd);
+	}
+}
+
+bool journal::generation(dnet_time &ts) const
+{
+	if (m_has_generation)
+		ts = m_generation;
+
+	return m_has_generation;
+}
+
+void journal::set_generation(const dnet_time &ts)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	m_generation = ts;
+	m_has_generation = true;
+	append(m_fd, record_generation, &ts, sizeof(ts));
+}
+
+void journal::recover(const std::function<void (const std::string &url, bool pending)> &fn)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	std::unordered_set<uint64_t> found;
+
+	replay(m_path, [&] (char type, const char *payload, uint32_t size) {
+		if (type != record_add)
+			return;
+
+		const uint64_t fp = journal_fingerprint(payload, size);
+		if (found.insert(fp).second)
+			fn(std::string(payload, size), m_pending.count(fp) != 0);
+	});
+}
+
+void journal::add(const std::string &url)
+{
+	add(journal_fingerprint(url.data(), url.size()), url);
+}
+
+void journal::done(const std::string &url)
+{
+	done(journal_fingerprint(url.data(), url.size()));
+}
+
+void journal::add(uint64_t fp, const std::string &url)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	m_pending.insert(fp);
+	append(m_fd, record_add, url.data(), url.size());
+}
+
+void journal::done(uint64_t fp)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	if (!m_pending.erase(fp))
+		return;
+
+	append(m_fd, record_done, &fp, sizeof(fp));
+
+	if (m_records >= journal_compact_min_records && m_records > 4 * m_pending.size())
+		compact();
+}
+
+size_t journal::replay(const std::string &path,
+		const std::function<void (char type, const char *payload, uint32_t size)> &fn)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+
+		journal_throw(path, "could not open");
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		journal_throw(path, "could not stat");
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		journal_throw(path, "could not map");
+
+	const char *data = (const char *)map;
+	const size_t header_size = 1 + sizeof(uint32_t);
+	size_t pos = 0;
+
+	while (pos + header_size <= (size_t)st.st_size) {
+		uint32_t size;
+		memcpy(&size, data + pos + 1, sizeof(size));
+
+		if (pos + header_size + size > (size_t)st.st_size)
+			break;
+
+		fn(data[pos], data + pos + header_size, size);
+		pos += header_size + size;
+	}
+
+	munmap(map, st.st_size);
+	return pos;
+}
+
+void journal::append(int fd, char type, const void *payload, uint32_t size)
+{
+	std::string record;
+	record.reserve(1 + sizeof(size) + size);
+
+	record.push_back(type);
+	record.append((const char *)&size, sizeof(size));
+	record.append((const char *)payload, size);
+
+	// single write() per record, so process crash can only leave torn record at the very end
+	if (write(fd, record.data(), record.size()) != (ssize_t)record.size())
+		journal_throw(m_path, "could not write");
+
+	if (fd == m_fd)
+		++m_records;
+}
+
+// rewrites journal with generation time and pending URLs only, must be called with @m_lock held
+void journal::compact()
+{
+	const std::string tmp_path = m_path + ".compact";
+
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		journal_throw(tmp_path, "could not open");
+
+	size_t records = 0;
+
+	try {
+		if (m_has_generation) {
+			append(fd, record_generation, &m_generation, sizeof(m_generation));
+			++records;
+		}
+
+		std::unordered_set<uint64_t> written;
+		replay(m_path, [&] (char type, const char *payload, uint32_t size) {
+			if (type != record_add)
+				return;
+
+			const uint64_t fp = journal_fingerprint(payload, size);
+			if (m_pending.count(fp) && written.insert(fp).second) {
+				append(fd, record_add, payload, size);
+				++records;
+			}
+		});
+
+		if (fdatasync(fd) < 0)
+			journal_throw(tmp_path, "could not sync");
+	} catch (...) {
+		close(fd);
+		unlink(tmp_path.c_str());
+		throw;
+	}
+
+	close(fd);
+
+	if (rename(tmp_path.c_str(), m_path.c_str()) < 0)
+		journal_throw(m_path, "could not replace");
+
+	int new_fd = open(m_path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+	if (new_fd < 0)
+		journal_throw(m_path, "could not reopen");
+
+	close(m_fd);
+	m_fd = new_fd;
+	m_records = records;
+}
+
+}} // namespace ioremap::wookie
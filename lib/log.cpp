@@ -0,0 +1,220 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wookie/log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+namespace ioremap { namespace wookie {
+
+// single producer single consumer ring of messages
+class logger::ring {
+	public:
+		enum {
+			size = 4096,
+		};
+
+		ring() : m_head(0), m_tail(0), m_abandoned(false) {
+		}
+
+		// called by owner thread only
+		bool push(std::string &&msg) {
+			const size_t head = m_head.load(std::memory_order_relaxed);
+			if (head - m_tail.load(std::memory_order_acquire) >= size)
+				return false;
+
+			m_slots[head % size] = std::move(msg);
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		// called by background thread only
+		bool pop(std::string &msg) {
+			const size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail == m_head.load(std::memory_order_acquire))
+				return false;
+
+			msg = std::move(m_slots[tail % size]);
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		void abandon() {
+			m_abandoned = true;
+		}
+
+		bool abandoned() const {
+			return m_abandoned;
+		}
+
+	private:
+		std::string m_slots[size];
+		std::atomic<size_t> m_head;
+		std::atomic<size_t> m_tail;
+		std::atomic_bool m_abandoned;
+};
+
+std::atomic_int logger::m_level(log_info);
+
+logger &logger::instance()
+{
+	static logger log;
+	return log;
+}
+
+logger::logger() : m_output(stdout), m_dropped(0), m_stop(false)
+{
+	m_thread = std::thread(std::bind(&logger::run, this));
+}
+
+logger::~logger()
+{
+	m_stop = true;
+	m_thread.join();
+
+	drain();
+
+	std::unique_lock<std::mutex> guard(m_output_lock);
+	fflush(m_output);
+	if (m_output != stdout)
+		fclose(m_output);
+}
+
+void logger::set_output(const std::string &path)
+{
+	FILE *out = stdout;
+
+	if (path != "/dev/stdout") {
+		out = fopen(path.c_str(), "a");
+		if (!out) {
+			std::ostringstream ss;
+			ss << "logger: could not open '" << path << "': " << strerror(errno);
+			throw std::runtime_error(ss.str());
+		}
+	}
+
+	std::unique_lock<std::mutex> guard(m_output_lock);
+	if (m_output != stdout)
+		fclose(m_output);
+	m_output = out;
+}
+
+logger::ring &logger::thread_ring()
+{
+	// ring is shared with logger, so messages written by exited thread are not lost
+	struct holder {
+		std::shared_ptr<ring> r;
+
+		~holder() {
+			if (r)
+				r->abandon();
+		}
+	};
+
+	static thread_local holder h;
+
+	if (!h.r) {
+		h.r = std::make_shared<ring>();
+
+		std::unique_lock<std::mutex> guard(m_lock);
+		m_rings.push_back(h.r);
+	}
+
+	return *h.r;
+}
+
+void logger::write(int level, std::string &&msg)
+{
+	static const char *names[] = { "ERROR", "INFO", "DEBUG" };
+
+	char ts[32];
+	struct timespec tp;
+	struct tm tm;
+
+	clock_gettime(CLOCK_REALTIME, &tp);
+	localtime_r(&tp.tv_sec, &tm);
+	size_t len = strftime(ts, sizeof(ts), "%F %T", &tm);
+	snprintf(ts + len, sizeof(ts) - len, ".%06ld", tp.tv_nsec / 1000);
+
+	std::string line;
+	line.reserve(msg.size() + 48);
+	line.append(ts);
+	line.append(" ");
+	line.append(names[std::min<int>(std::max(level, 0), log_debug)]);
+	line.append(": ");
+	line.append(msg);
+	line.append("\n");
+
+	if (!thread_ring().push(std::move(line)))
+		++m_dropped;
+}
+
+void logger::run()
+{
+	while (!m_stop) {
+		if (!drain())
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+// writes out all queued messages, returns false if there were none
+bool logger::drain()
+{
+	std::vector<std::shared_ptr<ring>> rings;
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+		rings = m_rings;
+	}
+
+	bool written = false;
+	std::string msg;
+
+	std::unique_lock<std::mutex> guard(m_output_lock);
+
+	for (auto && r : rings) {
+		while (r->pop(msg)) {
+			fwrite(msg.data(), 1, msg.size(), m_output);
+			written = true;
+		}
+	}
+
+	if (written)
+		fflush(m_output);
+
+	// forget rings of exited threads once they are empty
+	std::unique_lock<std::mutex> rings_guard(m_lock);
+	for (auto it = m_rings.begin(); it != m_rings.end();) {
+		std::string tmp;
+		if ((*it)->abandoned() && !(*it)->pop(tmp)) {
+			it = m_rings.erase(it);
+		} else {
+			if (tmp.size())
+				fwrite(tmp.data(), 1, tmp.size(), m_output);
+			++it;
+		}
+	}
+
+	return written;
+}
+
+}} // namespace ioremap::wookie
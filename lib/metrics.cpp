@@ -0,0 +1,298 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wookie/metrics.hpp"
+#include "wookie/log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace ioremap { namespace wookie {
+
+counter &metrics::get_counter(const std::string &name)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	std::unique_ptr<counter> &c = m_counters[name];
+	if (!c)
+		c.reset(new counter);
+
+	return *c;
+}
+
+histogram &metrics::get_histogram(const std::string &name)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	std::unique_ptr<histogram> &h = m_histograms[name];
+	if (!h)
+		h.reset(new histogram);
+
+	return *h;
+}
+
+void metrics::add_gauge(const std::string &name, const gauge_functor &gauge)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_gauges[name] = gauge;
+}
+
+std::string metrics::text()
+{
+	std::ostringstream ss;
+
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	for (auto && c : m_counters)
+		ss << c.first << " " << c.second->value() << "\n";
+
+	for (auto && g : m_gauges)
+		ss << g.first << " " << g.second() << "\n";
+
+	for (auto && h : m_histograms) {
+		const histogram &hist = *h.second;
+		const long count = hist.count();
+
+		ss << h.first << ".count " << count << "\n";
+		ss << h.first << ".avg_us " << (count ? hist.sum() / count : 0) << "\n";
+		ss << h.first << ".p50_us " << hist.quantile(0.5) << "\n";
+		ss << h.first << ".p90_us " << hist.quantile(0.9) << "\n";
+		ss << h.first << ".p99_us " << hist.quantile(0.99) << "\n";
+	}
+
+	return ss.str();
+}
+
+std::string metrics::json()
+{
+	std::ostringstream ss;
+
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	// metric names are plain identifiers, they are not escaped
+	ss << "{\"counters\":{";
+	for (auto it = m_counters.begin(); it != m_counters.end(); ++it) {
+		if (it != m_counters.begin())
+			ss << ",";
+		ss << "\"" << it->first << "\":" << it->second->value();
+	}
+
+	ss << "},\"gauges\":{";
+	for (auto it = m_gauges.begin(); it != m_gauges.end(); ++it) {
+		if (it != m_gauges.begin())
+			ss << ",";
+		ss << "\"" << it->first << "\":" << it->second();
+	}
+
+	ss << "},\"histograms\":{";
+	for (auto it = m_histograms.begin(); it != m_histograms.end(); ++it) {
+		const histogram &hist = *it->second;
+
+		if (it != m_histograms.begin())
+			ss << ",";
+
+		ss << "\"" << it->first << "\":{" <<
+			"\"count\":" << hist.count() <<
+			",\"sum_us\":" << hist.sum() <<
+			",\"p50_us\":" << hist.quantile(0.5) <<
+			",\"p90_us\":" << hist.quantile(0.9) <<
+			",\"p99_us\":" << hist.quantile(0.99) <<
+			",\"buckets\":[";
+
+		// the last bucket is unbounded, it is reported with null upper bound
+		for (int i = 0; i < histogram::buckets; ++i) {
+			if (i)
+				ss << ",";
+
+			ss << "[";
+			if (i == histogram::buckets - 1)
+				ss << "null";
+			else
+				ss << histogram::bound(i);
+			ss << "," << hist.bucket(i) << "]";
+		}
+
+		ss << "]}";
+	}
+
+	ss << "}}";
+	return ss.str();
+}
+
+metrics_dumper::metrics_dumper(metrics &m, const std::string &path, int interval, bool json) :
+m_metrics(m),
+m_path(path),
+m_interval(std::max(1, interval)),
+m_json(json),
+m_stop(false),
+m_thread(std::bind(&metrics_dumper::run, this))
+{
+}
+
+metrics_dumper::~metrics_dumper()
+{
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+		m_stop = true;
+		m_cond.notify_all();
+	}
+
+	m_thread.join();
+
+	// final snapshot contains the whole run
+	dump();
+}
+
+void metrics_dumper::run()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	while (!m_cond.wait_for(guard, std::chrono::seconds(m_interval), [this] { return m_stop; })) {
+		guard.unlock();
+		dump();
+		guard.lock();
+	}
+}
+
+void metrics_dumper::dump()
+{
+	const std::string snapshot = m_json ? m_metrics.json() + "\n" : m_metrics.text();
+
+	if (m_path.empty()) {
+		WOOKIE_LOG(log_info, "Metrics:\n" << snapshot);
+		return;
+	}
+
+	const std::string tmp = m_path + ".tmp";
+
+	FILE *out = fopen(tmp.c_str(), "w");
+	if (!out) {
+		WOOKIE_LOG(log_error, "Could not write metrics: " << tmp << ": " << strerror(errno));
+		return;
+	}
+
+	fwrite(snapshot.data(), 1, snapshot.size(), out);
+	fclose(out);
+
+	if (rename(tmp.c_str(), m_path.c_str()) < 0)
+		WOOKIE_LOG(log_error, "Could not write metrics: " << m_path << ": " << strerror(errno));
+}
+
+metrics_server::metrics_server(metrics &m, int port) :
+m_metrics(m),
+m_fd(-1),
+m_stop(false)
+{
+	m_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (m_fd < 0)
+		throw std::runtime_error(std::string("metrics server: could not create socket: ") + strerror(errno));
+
+	int on = 1;
+	setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(m_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(m_fd, 16) < 0) {
+		int err = errno;
+		close(m_fd);
+
+		std::ostringstream ss;
+		ss << "metrics server: could not listen on 127.0.0.1:" << port << ": " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+
+	m_thread = std::thread(std::bind(&metrics_server::run, this));
+}
+
+metrics_server::~metrics_server()
+{
+	m_stop = true;
+	m_thread.join();
+	close(m_fd);
+}
+
+void metrics_server::run()
+{
+	struct pollfd pfd;
+	pfd.fd = m_fd;
+	pfd.events = POLLIN;
+
+	// accept loop wakes up periodically to check stop flag
+	while (!m_stop) {
+		if (poll(&pfd, 1, 200) <= 0)
+			continue;
+
+		int fd = accept(m_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		serve(fd);
+		close(fd);
+	}
+}
+
+void metrics_server::serve(int fd)
+{
+	struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	// only request line is needed, the rest of request is ignored
+	char buf[1024];
+	ssize_t len = recv(fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return;
+	buf[len] = '\0';
+
+	const std::string request(buf);
+	const bool json = request.compare(0, 18, "GET /metrics.json ") == 0;
+
+	const std::string body = json ? m_metrics.json() : m_metrics.text();
+
+	std::ostringstream ss;
+	ss << "HTTP/1.0 200 OK\r\n" <<
+		"Content-Type: " << (json ? "application/json" : "text/plain") << "\r\n" <<
+		"Content-Length: " << body.size() << "\r\n" <<
+		"Connection: close\r\n\r\n" <<
+		body;
+
+	const std::string reply = ss.str();
+	for (size_t sent = 0; sent < reply.size();) {
+		ssize_t err = send(fd, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+		if (err <= 0)
+			break;
+
+		sent += err;
+	}
+}
+
+}} // namespace ioremap::wookie
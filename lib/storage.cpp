@@ -16,42 +16,125 @@
 
 #include "wookie/storage.hpp"
 
+#include <string.h>
+
 namespace ioremap { namespace wookie {
 
-storage::storage(elliptics::node &&node) : m_node(node), m_sess(m_node) {
-	m_sess.set_exceptions_policy(elliptics::session::no_exceptions);
-	m_sess.set_ioflags(DNET_IO_FLAGS_CACHE);
-	m_sess.set_timeout(1000);
+storage::storage(const elliptics::session &sess) : m_backend(new elliptics_backend(sess)) {
+	m_terms.reset(new term_dictionary(*this));
+	m_indexer.reset(new index_writer(*this));
+}
+
+storage::storage(std::unique_ptr<storage_backend> &&backend) : m_backend(std::move(backend)) {
+	m_terms.reset(new term_dictionary(*this));
+	m_indexer.reset(new index_writer(*this));
 }
 
-void storage::set_groups(const std::vector<int> groups) {
-	m_sess.set_groups(groups);
+storage::~storage() {
+	m_indexer.reset();
+	m_terms.reset();
 }
 
 void storage::set_namespace(const std::string &ns) {
-	m_sess.set_namespace(ns.c_str(), ns.size());
+	m_namespace = ns;
+}
+
+storage_backend &storage::backend() {
+	return *m_backend;
 }
 
 std::vector<elliptics::find_indexes_result_entry> storage::find(const std::vector<std::string> &indexes) {
-	return std::move(create_session().find_all_indexes(indexes));
+	return find(transform(m_namespace, indexes));
 }
 
 std::vector<elliptics::find_indexes_result_entry> storage::find(const std::vector<dnet_raw_id> &indexes) {
-	return std::move(create_session().find_all_indexes(indexes));
+	return find_all_indexes(indexes).get();
+}
+
+async_find_result storage::find_all_indexes(const std::vector<dnet_raw_id> &indexes) {
+	return m_backend->find_all_indexes(indexes);
+}
+
+async_write_result storage::set_indexes(const std::string &key, const std::vector<std::string> &indexes,
+		const std::vector<elliptics::data_pointer> &datas) {
+	const std::vector<dnet_raw_id> ids = transform(m_namespace, indexes);
+
+	std::vector<elliptics::index_entry> entries(ids.size());
+	for (size_t i = 0; i < ids.size(); ++i) {
+		entries[i].index = ids[i];
+		entries[i].data = datas[i];
+	}
+
+	return m_backend->set_indexes(m_namespace, key, entries);
+}
+
+std::vector<async_write_result> storage::bulk_set_indexes(const std::vector<index_update> &updates) {
+	return m_backend->bulk_set_indexes(m_namespace, updates);
 }
 
-elliptics::async_write_result storage::write_document(ioremap::wookie::document &d) {
-	msgpack::sbuffer buffer;
-	msgpack::pack(&buffer, d);
+index_writer &storage::indexer() {
+	return *m_indexer;
+}
+
+// msgpack stream which only counts bytes, it sizes buffer before object is packed into it
+struct pack_size_counter {
+	size_t size;
+
+	pack_size_counter() : size(0) {}
+
+	void write(const char *, size_t sz) {
+		size += sz;
+	}
+};
+
+// msgpack stream over preallocated buffer of exact size
+struct pack_buffer_writer {
+	char *ptr;
+
+	void write(const char *data, size_t sz) {
+		memcpy(ptr, data, sz);
+		ptr += sz;
+	}
+};
+
+// packs @obj directly into buffer owned by data_pointer: the first pass only computes
+// packed size, the second one writes it, so document body is copied exactly once
+template <typename T>
+static elliptics::data_pointer pack_data(const T &obj) {
+	pack_size_counter counter;
+	msgpack::pack(counter, obj);
+
+	elliptics::data_pointer ret = elliptics::data_pointer::allocate(counter.size);
+
+	pack_buffer_writer writer;
+	writer.ptr = ret.data<char>();
+	msgpack::pack(writer, obj);
 
-	return create_session().write_data(d.key, elliptics::data_pointer::copy(buffer.data(), buffer.size()), 0);
+	return ret;
 }
 
-elliptics::data_pointer storage::pack_document(ioremap::wookie::document &doc) {
-	msgpack::sbuffer buffer;
-	msgpack::pack(&buffer, doc);
+// unpacker does not copy raw data, raw object references @buffer it has been unpacked from
+static elliptics::data_pointer raw_slice(const elliptics::data_pointer &buffer, const msgpack::object &o) {
+	if (o.type != msgpack::type::RAW)
+		throw msgpack::type_error();
 
-	return elliptics::data_pointer::copy(buffer.data(), buffer.size());
+	const char *begin = buffer.data<char>();
+	const char *ptr = o.via.raw.ptr;
+
+	if (ptr < begin || ptr + o.via.raw.size > begin + buffer.size())
+		return elliptics::data_pointer::copy(ptr, o.via.raw.size);
+
+	return buffer.slice(ptr - begin, o.via.raw.size);
+}
+
+async_write_result storage::write_document(const ioremap::wookie::document &d) {
+	return m_backend->write(m_namespace, d.key, pack_document(d));
+}
+
+// body is compressed here, on the writer side, so both storage and every reader
+// which fetches document from it deal with compressed body
+elliptics::data_pointer storage::pack_document(const ioremap::wookie::document &doc) {
+	return pack_data(encoded_document(doc));
 }
 
 elliptics::data_pointer storage::pack_document(const std::string &url, const std::string &data) {
@@ -64,52 +147,217 @@ elliptics::data_pointer storage::pack_document(const std::string &url, const std
 }
 
 document storage::unpack_document(const elliptics::data_pointer &result) {
+	return unpack_document_view(result).to_document();
+}
+
+document_view storage::unpack_document_view(const elliptics::data_pointer &result) {
 	msgpack::unpacked msg;
 	msgpack::unpack(&msg, result.data<char>(), result.size());
 
-	document doc;
-	msg.get().convert(&doc);
+	const msgpack::object &o = msg.get();
+	if (o.type != msgpack::type::ARRAY || (o.via.array.size != 4 && o.via.array.size != 6))
+		elliptics::throw_error(-EPROTO, "msgpack: document array size mismatch: compiled: %d or %d, unpacked: %d",
+				4, 6, o.type == msgpack::type::ARRAY ? o.via.array.size : 0);
+
+	msgpack::object *p = o.via.array.ptr;
+
+	const int expected = o.via.array.size == 4 ? document::version_raw : document::version;
+
+	int version;
+	p[0].convert(&version);
+
+	if (version != expected)
+		elliptics::throw_error(-EPROTO, "msgpack: document version mismatch: compiled: %d, unpacked: %d",
+				expected, version);
+
+	document_view view;
+	p[1].convert(&view.ts);
+	view.key = raw_slice(result, p[2]);
+
+	if (version == document::version_raw) {
+		view.data = raw_slice(result, p[3]);
+		view.size = view.data.size();
+		return view;
+	}
+
+	p[3].convert(&view.codec);
+	p[4].convert(&view.size);
+	view.data = raw_slice(result, p[5]);
+
+	// body is decoded lazily, its size is checked before anyone allocates buffer for it
+	check_size(view.codec, view.data.size(), view.size);
 
-	return doc;
+	return view;
 }
 
-elliptics::async_read_result storage::read_data(const elliptics::key &key) {
-	return create_session().read_data(key, 0, 0);
+async_write_result storage::write_alias(const std::string &key, const document_alias &alias) {
+	return m_backend->write(m_namespace, key, pack_data(alias));
+}
+
+async_write_result storage::write_document_meta(const std::string &key, const document_meta &meta) {
+	return m_backend->write(meta_namespace(), key, pack_data(meta));
+}
+
+async_read_result storage::read_document_meta(const std::string &key) {
+	return m_backend->read(meta_namespace(), key);
+}
+
+async_read_result storage::bulk_read_document_meta(const std::vector<std::string> &keys) {
+	return m_backend->bulk_read(meta_namespace(), keys);
+}
+
+std::vector<dnet_raw_id> storage::transform_meta_keys(const std::vector<std::string> &keys) {
+	return transform(meta_namespace(), keys);
+}
+
+document_meta storage::unpack_document_meta(const elliptics::data_pointer &result) {
+	msgpack::unpacked msg;
+	msgpack::unpack(&msg, result.data<char>(), result.size());
+
+	document_meta meta;
+	msg.get().convert(&meta);
+
+	return meta;
+}
+
+// metadata lives in its own namespace under the same key as document, so it can be
+// read in bulk for all links of a page without touching document bodies
+std::string storage::meta_namespace() const {
+	return m_namespace + ".meta";
+}
+
+bool storage::is_alias(const elliptics::data_pointer &result) {
+	msgpack::unpacked msg;
+	msgpack::unpack(&msg, result.data<char>(), result.size());
+
+	const msgpack::object &o = msg.get();
+	return o.type == msgpack::type::ARRAY && o.via.array.size == 3;
+}
+
+document_alias storage::unpack_alias(const elliptics::data_pointer &result) {
+	msgpack::unpacked msg;
+	msgpack::unpack(&msg, result.data<char>(), result.size());
+
+	document_alias alias;
+	msg.get().convert(&alias);
+
+	return alias;
+}
+
+// fingerprint is attached to every band index of the document, so documents which
+// share at least one band can be found with a single find_any_indexes() request
+async_write_result storage::add_fingerprint(const std::string &key, uint64_t fp) {
+	const std::vector<dnet_raw_id> ids = transform(fingerprint_namespace(), simhash::band_indexes(fp));
+
+	elliptics::data_pointer data = pack_data(simhash::fingerprint_data(fp, key));
+
+	std::vector<elliptics::index_entry> indexes(ids.size());
+	for (size_t i = 0; i < ids.size(); ++i) {
+		indexes[i].index = ids[i];
+		indexes[i].data = data;
+	}
+
+	// fingerprints live in their own namespace, otherwise set_indexes() issued for the same key
+	// by index processors would remove document from band indexes
+	return m_backend->update_indexes(fingerprint_namespace(), key, indexes);
+}
+
+async_find_result storage::find_fingerprints(uint64_t fp) {
+	return m_backend->find_any_indexes(transform(fingerprint_namespace(), simhash::band_indexes(fp)));
+}
+
+std::string storage::fingerprint_namespace() const {
+	return m_namespace + ".simhash";
+}
+
+// change history is small and updated after every fetch, it is kept apart from documents
+// so that it can be read without document body
+async_write_result storage::write_recrawl_state(const std::string &key, const recrawl_state &st) {
+	return m_backend->write(recrawl_namespace(), key, pack_data(st));
+}
+
+async_read_result storage::read_recrawl_state(const std::string &key) {
+	return m_backend->read(recrawl_namespace(), key);
+}
+
+recrawl_state storage::unpack_recrawl_state(const elliptics::data_pointer &result) {
+	msgpack::unpacked msg;
+	msgpack::unpack(&msg, result.data<char>(), result.size());
+
+	recrawl_state st;
+	msg.get().convert(&st);
+
+	return st;
+}
+
+std::string storage::recrawl_namespace() const {
+	return m_namespace + ".recrawl";
+}
+
+async_read_result storage::read_data(const elliptics::key &key) {
+	return m_backend->read(m_namespace, key);
+}
+
+async_read_result storage::bulk_read_data(const std::vector<std::string> &keys) {
+	return m_backend->bulk_read(m_namespace, keys);
 }
 
 document storage::read_document(const elliptics::key &key) {
-	auto ret = read_data(key);
-	ret.wait();
+	elliptics::key k = key;
+
+	// aliases (redirects and near duplicates) are followed up to the document they point to
+	for (int hops = 0; hops < max_alias_hops; ++hops) {
+		auto ret = read_data(k);
 
-	if (ret.error().code())
-		elliptics::throw_error(ret.error().code(), "Could not read url %s", key.to_string().c_str());
+		if (ret.error().code() || ret.get().empty())
+			elliptics::throw_error(ret.error().code() ? ret.error().code() : -ENOENT,
+					"Could not read url %s", k.to_string().c_str());
 
-	const elliptics::data_pointer &result = ret.get_one().file();
-	return unpack_document(result);
+		const elliptics::data_pointer &result = ret.get()[0].data;
+		if (!is_alias(result))
+			return unpack_document(result);
+
+		const document_alias alias = unpack_alias(result);
+		if (alias.rejected())
+			elliptics::throw_error(-ENOENT, "Could not read url %s: it has been rejected by filters", k.to_string().c_str());
+
+		k = elliptics::key(alias.target);
+	}
+
+	elliptics::throw_error(-ELOOP, "Could not read url %s: too many aliases", key.to_string().c_str());
+	return document();
 }
 
 std::vector<dnet_raw_id> storage::transform_tokens(const std::vector<std::string> &tokens) {
-	elliptics::session s = create_session();
-	std::vector<dnet_raw_id> results;
+	return transform(m_namespace, tokens);
+}
 
-	results.reserve(tokens.size());
-	dnet_raw_id id;
+std::vector<dnet_raw_id> storage::transform(const std::string &ns, const std::vector<std::string> &tokens) {
+	return m_backend->transform(ns, tokens);
+}
 
-	for (auto t : tokens) {
-		s.transform(t, id);
-		results.emplace_back(id);
-	}
+term_dictionary &storage::terms() {
+	return *m_terms;
+}
 
-	return std::move(results);
+async_read_result storage::read_term_record(const std::string &key) {
+	return m_backend->read(terms_namespace(), key);
 }
 
-elliptics::session storage::create_session(void) {
-	return m_sess.clone();
+async_write_result storage::append_term_record(const std::string &key, const elliptics::data_pointer &data) {
+	return m_backend->append(terms_namespace(), key, data);
+}
+
+std::string storage::terms_namespace() const {
+	return m_namespace + ".terms";
 }
 
-elliptics::node storage::get_node()
-{
-	return m_sess.get_node();
+elliptics::session storage::create_session(void) {
+	elliptics_backend *backend = dynamic_cast<elliptics_backend *>(m_backend.get());
+	if (!backend)
+		elliptics::throw_error(-ENOTSUP, "storage: elliptics session requested, but storage backend is not elliptics");
+
+	return backend->create_session(m_namespace);
 }
 
 }}
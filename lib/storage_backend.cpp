@@ -0,0 +1,1013 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wookie/storage_backend.hpp"
+#include "wookie/hash.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <stdexcept>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace ioremap { namespace wookie {
+
+std::vector<async_write_result> storage_backend::bulk_set_indexes(const std::string &ns,
+		const std::vector<index_update> &updates)
+{
+	std::vector<async_write_result> ret;
+	ret.reserve(updates.size());
+
+	for (auto && update : updates)
+		ret.emplace_back(set_indexes(ns, update.key, update.indexes));
+
+	return ret;
+}
+
+/*
+ * elliptics backend
+ */
+
+static elliptics::session clone_session(elliptics::session sess)
+{
+	return sess.clone();
+}
+
+static void raw_id_from_cmd(dnet_raw_id &id, const dnet_cmd *cmd)
+{
+	memcpy(id.id, cmd->id.id, DNET_ID_SIZE);
+}
+
+// entries which carry errors (missing key in bulk read, failed group) are not reported,
+// error of the whole operation comes with final handler
+template <typename R>
+static async_write_result adapt_write(elliptics::async_result<R> &&result)
+{
+	async_write_result ret;
+
+	result.connect([ret] (const R &entry) mutable {
+		if (entry.error())
+			return;
+
+		write_entry we;
+		raw_id_from_cmd(we.id, entry.command());
+		ret.process(we);
+	}, [ret] (const elliptics::error_info &error) mutable {
+		ret.complete(error);
+	});
+
+	return ret;
+}
+
+static async_read_result adapt_read(elliptics::async_read_result &&result)
+{
+	async_read_result ret;
+
+	result.connect([ret] (const elliptics::read_result_entry &entry) mutable {
+		if (entry.error())
+			return;
+
+		read_entry re;
+		raw_id_from_cmd(re.id, entry.command());
+		re.data = entry.file();
+		ret.process(re);
+	}, [ret] (const elliptics::error_info &error) mutable {
+		ret.complete(error);
+	});
+
+	return ret;
+}
+
+static async_find_result adapt_find(elliptics::async_find_indexes_result &&result)
+{
+	async_find_result ret;
+
+	result.connect([ret] (const elliptics::find_indexes_result_entry &entry) mutable {
+		ret.process(entry);
+	}, [ret] (const elliptics::error_info &error) mutable {
+		ret.complete(error);
+	});
+
+	return ret;
+}
+
+elliptics_backend::elliptics_backend(elliptics::node &&node) : m_sess(node)
+{
+	m_sess.set_exceptions_policy(elliptics::session::no_exceptions);
+	m_sess.set_ioflags(DNET_IO_FLAGS_CACHE);
+	m_sess.set_timeout(1000);
+}
+
+elliptics_backend::elliptics_backend(const elliptics::session &sess) : m_sess(clone_session(sess))
+{
+	m_sess.set_exceptions_policy(elliptics::session::no_exceptions);
+}
+
+void elliptics_backend::set_groups(const std::vector<int> &groups)
+{
+	m_sess.set_groups(groups);
+}
+
+elliptics::node elliptics_backend::get_node()
+{
+	return m_sess.get_node();
+}
+
+elliptics::session elliptics_backend::create_session(const std::string &ns)
+{
+	elliptics::session sess = m_sess.clone();
+	if (ns.size())
+		sess.set_namespace(ns.c_str(), ns.size());
+
+	return sess;
+}
+
+std::vector<dnet_raw_id> elliptics_backend::transform(const std::string &ns, const std::vector<std::string> &keys)
+{
+	elliptics::session sess = create_session(ns);
+
+	std::vector<dnet_raw_id> ids(keys.size());
+	for (size_t i = 0; i < keys.size(); ++i)
+		sess.transform(keys[i], ids[i]);
+
+	return ids;
+}
+
+async_write_result elliptics_backend::write(const std::string &ns, const elliptics::key &key,
+		const elliptics::data_pointer &data)
+{
+	return adapt_write(create_session(ns).write_data(key, data, 0));
+}
+
+async_write_result elliptics_backend::append(const std::string &ns, const elliptics::key &key,
+		const elliptics::data_pointer &data)
+{
+	elliptics::session sess = create_session(ns);
+	sess.set_ioflags(DNET_IO_FLAGS_APPEND);
+
+	return adapt_write(sess.write_data(key, data, 0));
+}
+
+async_read_result elliptics_backend::read(const std::string &ns, const elliptics::key &key)
+{
+	return adapt_read(create_session(ns).read_data(key, 0, 0));
+}
+
+async_read_result elliptics_backend::bulk_read(const std::string &ns, const std::vector<std::string> &keys)
+{
+	return adapt_read(create_session(ns).bulk_read(keys));
+}
+
+async_write_result elliptics_backend::set_indexes(const std::string &ns, const std::string &key,
+		const std::vector<elliptics::index_entry> &indexes)
+{
+	return adapt_write(create_session(ns).set_indexes(key, indexes));
+}
+
+async_write_result elliptics_backend::update_indexes(const std::string &ns, const std::string &key,
+		const std::vector<elliptics::index_entry> &indexes)
+{
+	return adapt_write(create_session(ns).update_indexes(key, indexes));
+}
+
+async_find_result elliptics_backend::find_all_indexes(const std::vector<dnet_raw_id> &indexes)
+{
+	return adapt_find(create_session(std::string()).find_all_indexes(indexes));
+}
+
+async_find_result elliptics_backend::find_any_indexes(const std::vector<dnet_raw_id> &indexes)
+{
+	return adapt_find(create_session(std::string()).find_any_indexes(indexes));
+}
+
+/*
+ * in-memory secondary indexes
+ */
+
+static bool raw_id_less(const dnet_raw_id &a, const dnet_raw_id &b)
+{
+	return memcmp(a.id, b.id, DNET_ID_SIZE) < 0;
+}
+
+static std::vector<dnet_raw_id> unique_ids(const std::vector<dnet_raw_id> &ids)
+{
+	std::vector<dnet_raw_id> ret(ids);
+
+	std::sort(ret.begin(), ret.end(), raw_id_less);
+	ret.erase(std::unique(ret.begin(), ret.end(), raw_id_equal()), ret.end());
+
+	return ret;
+}
+
+// found objects are sorted by ID, so local backends return them in stable order
+static void sort_found(sync_find_result &result)
+{
+	std::sort(result.begin(), result.end(),
+		[] (const elliptics::find_indexes_result_entry &a, const elliptics::find_indexes_result_entry &b) {
+			return raw_id_less(a.id, b.id);
+		});
+}
+
+bool index_table::remove(const dnet_raw_id &object)
+{
+	auto it = m_objects.find(object);
+	if (it == m_objects.end())
+		return false;
+
+	for (auto && index : it->second) {
+		auto iit = m_indexes.find(index);
+		if (iit == m_indexes.end())
+			continue;
+
+		iit->second.erase(object);
+		if (iit->second.empty())
+			m_indexes.erase(iit);
+	}
+
+	m_objects.erase(it);
+	return true;
+}
+
+void index_table::update(const dnet_raw_id &object, const std::vector<elliptics::index_entry> &indexes)
+{
+	if (indexes.empty())
+		return;
+
+	std::vector<dnet_raw_id> &object_indexes = m_objects[object];
+
+	for (auto && entry : indexes) {
+		auto ret = m_indexes[entry.index].insert(std::make_pair(object, entry.data));
+		if (ret.second)
+			object_indexes.push_back(entry.index);
+		else
+			ret.first->second = entry.data;
+	}
+}
+
+sync_find_result index_table::find_all(const std::vector<dnet_raw_id> &ids) const
+{
+	sync_find_result ret;
+
+	const std::vector<dnet_raw_id> indexes = unique_ids(ids);
+	if (indexes.empty())
+		return ret;
+
+	std::vector<const object_map *> objects;
+	objects.reserve(indexes.size());
+
+	size_t smallest = 0;
+	for (auto && index : indexes) {
+		auto it = m_indexes.find(index);
+		if (it == m_indexes.end())
+			return ret;
+
+		if (objects.empty() || it->second.size() < objects[smallest]->size())
+			smallest = objects.size();
+
+		objects.push_back(&it->second);
+	}
+
+	// the smallest index is scanned, every other one is only probed
+	for (auto && object : *objects[smallest]) {
+		elliptics::find_indexes_result_entry entry;
+		entry.id = object.first;
+		entry.indexes.reserve(indexes.size());
+
+		for (size_t i = 0; i < indexes.size(); ++i) {
+			auto it = objects[i]->find(object.first);
+			if (it == objects[i]->end())
+				break;
+
+			elliptics::index_entry index;
+			index.index = indexes[i];
+			index.data = it->second;
+			entry.indexes.emplace_back(index);
+		}
+
+		if (entry.indexes.size() == indexes.size())
+			ret.emplace_back(std::move(entry));
+	}
+
+	sort_found(ret);
+	return ret;
+}
+
+sync_find_result index_table::find_any(const std::vector<dnet_raw_id> &ids) const
+{
+	std::unordered_map<dnet_raw_id, elliptics::find_indexes_result_entry, raw_id_hash, raw_id_equal> found;
+
+	for (auto && id : unique_ids(ids)) {
+		auto it = m_indexes.find(id);
+		if (it == m_indexes.end())
+			continue;
+
+		for (auto && object : it->second) {
+			elliptics::find_indexes_result_entry &entry = found[object.first];
+			entry.id = object.first;
+
+			elliptics::index_entry index;
+			index.index = id;
+			index.data = object.second;
+			entry.indexes.emplace_back(index);
+		}
+	}
+
+	sync_find_result ret;
+	ret.reserve(found.size());
+	for (auto && it : found)
+		ret.emplace_back(std::move(it.second));
+
+	sort_found(ret);
+	return ret;
+}
+
+/*
+ * local backends
+ */
+
+// 64-byte ID of namespace and key built of MurmurHash64A with different seeds,
+// namespace is separated from key, so that 'a' + 'bc' and 'ab' + 'c' differ
+static dnet_raw_id local_transform(const std::string &ns, const std::string &key)
+{
+	std::string name;
+	name.reserve(ns.size() + 1 + key.size());
+	name.append(ns);
+	name.push_back('\0');
+	name.append(key);
+
+	dnet_raw_id id;
+	for (size_t i = 0; i < DNET_ID_SIZE / sizeof(uint64_t); ++i) {
+		const uint64_t h = hash::murmur(name, i);
+		memcpy(id.id + i * sizeof(h), &h, sizeof(h));
+	}
+
+	return id;
+}
+
+static std::vector<dnet_raw_id> local_transform(const std::string &ns, const std::vector<std::string> &keys)
+{
+	std::vector<dnet_raw_id> ids;
+	ids.reserve(keys.size());
+
+	for (auto && key : keys)
+		ids.emplace_back(local_transform(ns, key));
+
+	return ids;
+}
+
+static dnet_raw_id local_id(const std::string &ns, const elliptics::key &key)
+{
+	if (key.by_id())
+		return key.raw_id();
+
+	return local_transform(ns, key.remote());
+}
+
+static async_write_result written(const dnet_raw_id &id)
+{
+	async_write_result ret;
+
+	write_entry entry;
+	entry.id = id;
+
+	ret.process(entry);
+	ret.complete(elliptics::error_info());
+	return ret;
+}
+
+template <typename T>
+static async_result<T> failed(const elliptics::error_info &error)
+{
+	async_result<T> ret;
+	ret.complete(error);
+	return ret;
+}
+
+static async_find_result found(const sync_find_result &result)
+{
+	async_find_result ret;
+
+	for (auto && entry : result)
+		ret.process(entry);
+
+	ret.complete(elliptics::error_info());
+	return ret;
+}
+
+std::vector<dnet_raw_id> memory_backend::transform(const std::string &ns, const std::vector<std::string> &keys)
+{
+	return local_transform(ns, keys);
+}
+
+async_write_result memory_backend::write(const std::string &ns, const elliptics::key &key,
+		const elliptics::data_pointer &data)
+{
+	const dnet_raw_id id = local_id(ns, key);
+
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_objects[id] = data;
+	guard.unlock();
+
+	return written(id);
+}
+
+async_write_result memory_backend::append(const std::string &ns, const elliptics::key &key,
+		const elliptics::data_pointer &data)
+{
+	const dnet_raw_id id = local_id(ns, key);
+
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	elliptics::data_pointer &object = m_objects[id];
+	if (object.empty()) {
+		object = data;
+	} else {
+		// readers may hold the old buffer, it is never modified in place
+		elliptics::data_pointer joined = elliptics::data_pointer::allocate(object.size() + data.size());
+		memcpy(joined.data<char>(), object.data(), object.size());
+		memcpy(joined.data<char>() + object.size(), data.data(), data.size());
+		object = joined;
+	}
+
+	guard.unlock();
+
+	return written(id);
+}
+
+async_read_result memory_backend::read(const std::string &ns, const elliptics::key &key)
+{
+	read_entry entry;
+	entry.id = local_id(ns, key);
+
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		auto it = m_objects.find(entry.id);
+		if (it == m_objects.end())
+			return failed<read_entry>(elliptics::create_error(-ENOENT, "%s: object not found",
+						key.to_string().c_str()));
+
+		entry.data = it->second;
+	}
+
+	async_read_result ret;
+	ret.process(entry);
+	ret.complete(elliptics::error_info());
+	return ret;
+}
+
+async_read_result memory_backend::bulk_read(const std::string &ns, const std::vector<std::string> &keys)
+{
+	sync_read_result entries;
+	entries.reserve(keys.size());
+
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		for (auto && key : keys) {
+			read_entry entry;
+			entry.id = local_transform(ns, key);
+
+			auto it = m_objects.find(entry.id);
+			if (it == m_objects.end())
+				continue;
+
+			entry.data = it->second;
+			entries.emplace_back(entry);
+		}
+	}
+
+	async_read_result ret;
+	for (auto && entry : entries)
+		ret.process(entry);
+
+	if (entries.empty() && !keys.empty())
+		ret.complete(elliptics::create_error(-ENOENT, "bulk read: none of %zd objects has been found", keys.size()));
+	else
+		ret.complete(elliptics::error_info());
+
+	return ret;
+}
+
+async_write_result memory_backend::set_indexes(const std::string &ns, const std::string &key,
+		const std::vector<elliptics::index_entry> &indexes)
+{
+	const dnet_raw_id id = local_transform(ns, key);
+
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_indexes.remove(id);
+	m_indexes.update(id, indexes);
+	guard.unlock();
+
+	return written(id);
+}
+
+async_write_result memory_backend::update_indexes(const std::string &ns, const std::string &key,
+		const std::vector<elliptics::index_entry> &indexes)
+{
+	const dnet_raw_id id = local_transform(ns, key);
+
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_indexes.update(id, indexes);
+	guard.unlock();
+
+	return written(id);
+}
+
+std::vector<async_write_result> memory_backend::bulk_set_indexes(const std::string &ns,
+		const std::vector<index_update> &updates)
+{
+	std::vector<dnet_raw_id> ids;
+	ids.reserve(updates.size());
+	for (auto && update : updates)
+		ids.emplace_back(local_transform(ns, update.key));
+
+	std::unique_lock<std::mutex> guard(m_lock);
+	for (size_t i = 0; i < updates.size(); ++i) {
+		m_indexes.remove(ids[i]);
+		m_indexes.update(ids[i], updates[i].indexes);
+	}
+	guard.unlock();
+
+	std::vector<async_write_result> ret;
+	ret.reserve(ids.size());
+	for (auto && id : ids)
+		ret.emplace_back(written(id));
+
+	return ret;
+}
+
+async_find_result memory_backend::find_all_indexes(const std::vector<dnet_raw_id> &indexes)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	const sync_find_result result = m_indexes.find_all(indexes);
+	guard.unlock();
+
+	return found(result);
+}
+
+async_find_result memory_backend::find_any_indexes(const std::vector<dnet_raw_id> &indexes)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	const sync_find_result result = m_indexes.find_any(indexes);
+	guard.unlock();
+
+	return found(result);
+}
+
+/*
+ * local files
+ */
+
+static void file_backend_throw(const std::string &path, const char *what)
+{
+	std::ostringstream ss;
+	ss << "file backend: " << what << " '" << path << "': " << strerror(errno);
+	throw std::runtime_error(ss.str());
+}
+
+static int write_all(int fd, const char *data, size_t size)
+{
+	while (size) {
+		ssize_t err = ::write(fd, data, size);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -errno;
+		}
+
+		data += err;
+		size -= err;
+	}
+
+	return 0;
+}
+
+file_backend::file_backend(const std::string &path) : m_path(path), m_log_fd(-1)
+{
+	if (mkdir(m_path.c_str(), 0755) < 0 && errno != EEXIST)
+		file_backend_throw(m_path, "could not create");
+
+	const size_t valid = replay_log();
+
+	const std::string log_path = m_path + "/indexes.log";
+
+	m_log_fd = open(log_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (m_log_fd < 0)
+		file_backend_throw(log_path, "could not open");
+
+	// drop torn record left by crash
+	if (ftruncate(m_log_fd, valid) < 0) {
+		close(m_log_fd);
+		file_backend_throw(log_path, "could not truncate");
+	}
+}
+
+file_backend::~file_backend()
+{
+	if (m_log_fd >= 0) {
+		fdatasync(m_log_fd);
+		close(m_log_fd);
+	}
+}
+
+std::string file_backend::object_path(const dnet_raw_id &id, bool create_dir)
+{
+	char str[DNET_ID_SIZE * 2 + 1];
+	dnet_dump_id_len_raw(id.id, DNET_ID_SIZE, str);
+
+	std::string dir = m_path + "/" + std::string(str, 2);
+	if (create_dir)
+		mkdir(dir.c_str(), 0755);
+
+	return dir + "/" + str;
+}
+
+// object is replaced by rename(), so readers see either old or new content, never a mix
+int file_backend::write_object(const dnet_raw_id &id, const elliptics::data_pointer &data, bool append)
+{
+	static std::atomic<unsigned long> tmp_counter(0);
+
+	const std::string path = object_path(id, true);
+
+	if (append) {
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return -errno;
+
+		int err = write_all(fd, data.data<char>(), data.size());
+		close(fd);
+		return err;
+	}
+
+	std::ostringstream tmp;
+	tmp << path << ".tmp." << getpid() << "." << tmp_counter++;
+	const std::string tmp_path = tmp.str();
+
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	int err = write_all(fd, data.data<char>(), data.size());
+	close(fd);
+
+	if (!err && rename(tmp_path.c_str(), path.c_str()) < 0)
+		err = -errno;
+
+	if (err)
+		unlink(tmp_path.c_str());
+
+	return err;
+}
+
+int file_backend::read_object(const dnet_raw_id &id, elliptics::data_pointer &data)
+{
+	const std::string path = object_path(id, false);
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int err = -errno;
+		close(fd);
+		return err;
+	}
+
+	elliptics::data_pointer ret = elliptics::data_pointer::allocate(st.st_size);
+
+	size_t offset = 0;
+	while (offset < ret.size()) {
+		ssize_t err = pread(fd, ret.data<char>() + offset, ret.size() - offset, offset);
+		if (err < 0 && errno == EINTR)
+			continue;
+
+		if (err <= 0) {
+			int code = err < 0 ? -errno : -EIO;
+			close(fd);
+			return code;
+		}
+
+		offset += err;
+	}
+
+	close(fd);
+
+	data = ret;
+	return 0;
+}
+
+// record format: 1-byte type, 4-byte payload size, payload,
+// payload: object ID, then for every index: index ID, 4-byte data size, data
+void file_backend::pack_log_record(std::string &out, char type, const dnet_raw_id &object,
+		const std::vector<elliptics::index_entry> &indexes)
+{
+	std::string payload;
+	payload.append((const char *)object.id, DNET_ID_SIZE);
+
+	for (auto && index : indexes) {
+		const uint32_t size = index.data.size();
+
+		payload.append((const char *)index.index.id, DNET_ID_SIZE);
+		payload.append((const char *)&size, sizeof(size));
+		payload.append(index.data.data<char>(), size);
+	}
+
+	const uint32_t size = payload.size();
+
+	out.push_back(type);
+	out.append((const char *)&size, sizeof(size));
+	out.append(payload);
+}
+
+// single write() per call, so process crash can only leave torn record at the very end
+int file_backend::append_log(const std::string &records)
+{
+	return write_all(m_log_fd, records.data(), records.size());
+}
+
+size_t file_backend::replay_log()
+{
+	const std::string log_path = m_path + "/indexes.log";
+
+	int fd = open(log_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+
+		file_backend_throw(log_path, "could not open");
+	}
+
+	std::string log;
+	char buf[64 * 1024];
+	while (true) {
+		ssize_t err = ::read(fd, buf, sizeof(buf));
+		if (err < 0 && errno == EINTR)
+			continue;
+
+		if (err < 0) {
+			close(fd);
+			file_backend_throw(log_path, "could not read");
+		}
+
+		if (err == 0)
+			break;
+
+		log.append(buf, err);
+	}
+
+	close(fd);
+
+	const size_t header_size = 1 + sizeof(uint32_t);
+	size_t pos = 0;
+
+	while (pos + header_size <= log.size()) {
+		uint32_t size;
+		memcpy(&size, log.data() + pos + 1, sizeof(size));
+
+		if (pos + header_size + size > log.size() || size < DNET_ID_SIZE)
+			break;
+
+		const char type = log[pos];
+		const char *p = log.data() + pos + header_size;
+		const char *end = p + size;
+
+		dnet_raw_id object;
+		memcpy(object.id, p, DNET_ID_SIZE);
+		p += DNET_ID_SIZE;
+
+		std::vector<elliptics::index_entry> indexes;
+		while (p + DNET_ID_SIZE + sizeof(uint32_t) <= end) {
+			elliptics::index_entry index;
+			memcpy(index.index.id, p, DNET_ID_SIZE);
+			p += DNET_ID_SIZE;
+
+			uint32_t data_size;
+			memcpy(&data_size, p, sizeof(data_size));
+			p += sizeof(data_size);
+
+			if (p + data_size > end)
+				break;
+
+			index.data = elliptics::data_pointer::copy(p, data_size);
+			p += data_size;
+
+			indexes.emplace_back(index);
+		}
+
+		if (p != end) {
+			errno = EILSEQ;
+			file_backend_throw(log_path, "corrupted record in");
+		}
+
+		if (type == record_set)
+			m_indexes.remove(object);
+
+		m_indexes.update(object, indexes);
+		pos += header_size + size;
+	}
+
+	return pos;
+}
+
+std::vector<dnet_raw_id> file_backend::transform(const std::string &ns, const std::vector<std::string> &keys)
+{
+	return local_transform(ns, keys);
+}
+
+async_write_result file_backend::write(const std::string &ns, const elliptics::key &key,
+		const elliptics::data_pointer &data)
+{
+	const dnet_raw_id id = local_id(ns, key);
+
+	int err = write_object(id, data, false);
+	if (err)
+		return failed<write_entry>(elliptics::create_error(err, "%s: could not write object: %s",
+					key.to_string().c_str(), strerror(-err)));
+
+	return written(id);
+}
+
+async_write_result file_backend::append(const std::string &ns, const elliptics::key &key,
+		const elliptics::data_pointer &data)
+{
+	const dnet_raw_id id = local_id(ns, key);
+
+	int err = write_object(id, data, true);
+	if (err)
+		return failed<write_entry>(elliptics::create_error(err, "%s: could not append to object: %s",
+					key.to_string().c_str(), strerror(-err)));
+
+	return written(id);
+}
+
+async_read_result file_backend::read(const std::string &ns, const elliptics::key &key)
+{
+	read_entry entry;
+	entry.id = local_id(ns, key);
+
+	int err = read_object(entry.id, entry.data);
+	if (err)
+		return failed<read_entry>(elliptics::create_error(err, "%s: could not read object: %s",
+					key.to_string().c_str(), strerror(-err)));
+
+	async_read_result ret;
+	ret.process(entry);
+	ret.complete(elliptics::error_info());
+	return ret;
+}
+
+async_read_result file_backend::bulk_read(const std::string &ns, const std::vector<std::string> &keys)
+{
+	async_read_result ret;
+
+	size_t read = 0;
+	int last_err = -ENOENT;
+
+	for (auto && key : keys) {
+		read_entry entry;
+		entry.id = local_transform(ns, key);
+
+		int err = read_object(entry.id, entry.data);
+		if (err) {
+			if (err != -ENOENT)
+				last_err = err;
+			continue;
+		}
+
+		ret.process(entry);
+		++read;
+	}
+
+	if (!read && !keys.empty())
+		ret.complete(elliptics::create_error(last_err, "bulk read: none of %zd objects has been read: %s",
+					keys.size(), strerror(-last_err)));
+	else
+		ret.complete(elliptics::error_info());
+
+	return ret;
+}
+
+async_write_result file_backend::set_indexes(const std::string &ns, const std::string &key,
+		const std::vector<elliptics::index_entry> &indexes)
+{
+	const dnet_raw_id id = local_transform(ns, key);
+
+	std::string record;
+	pack_log_record(record, record_set, id, indexes);
+
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	int err = append_log(record);
+	if (err)
+		return failed<write_entry>(elliptics::create_error(err, "%s: could not log index update: %s",
+					key.c_str(), strerror(-err)));
+
+	m_indexes.remove(id);
+	m_indexes.update(id, indexes);
+	guard.unlock();
+
+	return written(id);
+}
+
+async_write_result file_backend::update_indexes(const std::string &ns, const std::string &key,
+		const std::vector<elliptics::index_entry> &indexes)
+{
+	const dnet_raw_id id = local_transform(ns, key);
+
+	std::string record;
+	pack_log_record(record, record_update, id, indexes);
+
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	int err = append_log(record);
+	if (err)
+		return failed<write_entry>(elliptics::create_error(err, "%s: could not log index update: %s",
+					key.c_str(), strerror(-err)));
+
+	m_indexes.update(id, indexes);
+	guard.unlock();
+
+	return written(id);
+}
+
+std::vector<async_write_result> file_backend::bulk_set_indexes(const std::string &ns,
+		const std::vector<index_update> &updates)
+{
+	std::vector<dnet_raw_id> ids;
+	ids.reserve(updates.size());
+
+	std::string records;
+	for (auto && update : updates) {
+		ids.emplace_back(local_transform(ns, update.key));
+		pack_log_record(records, record_set, ids.back(), update.indexes);
+	}
+
+	std::vector<async_write_result> ret;
+	ret.reserve(ids.size());
+
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	int err = append_log(records);
+	if (err) {
+		guard.unlock();
+
+		const elliptics::error_info error = elliptics::create_error(err, "could not log update of %zd indexes: %s",
+				updates.size(), strerror(-err));
+		for (size_t i = 0; i < ids.size(); ++i)
+			ret.emplace_back(failed<write_entry>(error));
+
+		return ret;
+	}
+
+	for (size_t i = 0; i < updates.size(); ++i) {
+		m_indexes.remove(ids[i]);
+		m_indexes.update(ids[i], updates[i].indexes);
+	}
+	guard.unlock();
+
+	for (auto && id : ids)
+		ret.emplace_back(written(id));
+
+	return ret;
+}
+
+async_find_result file_backend::find_all_indexes(const std::vector<dnet_raw_id> &indexes)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	const sync_find_result result = m_indexes.find_all(indexes);
+	guard.unlock();
+
+	return found(result);
+}
+
+async_find_result file_backend::find_any_indexes(const std::vector<dnet_raw_id> &indexes)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	const sync_find_result result = m_indexes.find_any(indexes);
+	guard.unlock();
+
+	return found(result);
+}
+
+}} // namespace ioremap::wookie
@@ -0,0 +1,326 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wookie/term_dictionary.hpp"
+#include "wookie/log.hpp"
+#include "wookie/storage.hpp"
+
+#include <string.h>
+
+namespace ioremap { namespace wookie {
+
+term_dictionary::term_dictionary(storage &st) : m_st(st), m_dirty(0)
+{
+}
+
+term_dictionary::~term_dictionary()
+{
+	try {
+		flush();
+	} catch (const std::exception &e) {
+		WOOKIE_LOG(log_error, "Term dictionary: could not flush document frequencies: " << e.what());
+	}
+}
+
+std::string term_dictionary::record_key(const dnet_raw_id &id)
+{
+	char str[DNET_ID_SIZE * 2 + 1];
+	return dnet_dump_id_len_raw(id.id, DNET_ID_SIZE, str);
+}
+
+// must be called with @m_lock held
+dnet_raw_id term_dictionary::insert(const std::string &term, const dnet_raw_id &id)
+{
+	auto ret = m_ids.insert(std::make_pair(term, id));
+	if (ret.second)
+		m_entries[id].info.term = term;
+
+	return ret.first->second;
+}
+
+// must be called with @m_lock held, entries with pending increments are never dropped
+void term_dictionary::shrink()
+{
+	if (m_entries.size() <= max_cached_terms)
+		return;
+
+	for (auto it = m_entries.begin(); it != m_entries.end();) {
+		if (it->second.pending) {
+			++it;
+			continue;
+		}
+
+		auto id_it = m_ids.find(it->second.info.term);
+		if (id_it != m_ids.end() && !memcmp(id_it->second.id, it->first.id, DNET_ID_SIZE))
+			m_ids.erase(id_it);
+
+		it = m_entries.erase(it);
+	}
+}
+
+dnet_raw_id term_dictionary::id(const std::string &term)
+{
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		auto it = m_ids.find(term);
+		if (it != m_ids.end())
+			return it->second;
+	}
+
+	return m_st.transform_tokens(std::vector<std::string>(1, term))[0];
+}
+
+std::vector<dnet_raw_id> term_dictionary::ids(const std::vector<std::string> &terms)
+{
+	// tokens which have not been seen yet are transformed without lock
+	std::vector<std::string> unknown;
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		for (auto && term : terms) {
+			if (!m_ids.count(term))
+				unknown.push_back(term);
+		}
+	}
+
+	const std::vector<dnet_raw_id> transformed = m_st.transform_tokens(unknown);
+
+	std::vector<dnet_raw_id> ret;
+	ret.reserve(terms.size());
+
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	for (size_t i = 0; i < unknown.size(); ++i)
+		insert(unknown[i], transformed[i]);
+
+	for (auto && term : terms)
+		ret.push_back(m_ids[term]);
+
+	shrink();
+	return ret;
+}
+
+void term_dictionary::add_document(const std::vector<std::string> &terms)
+{
+	const std::vector<dnet_raw_id> term_ids = ids(terms);
+
+	bool need_flush;
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		// entry may have been dropped from cache since ids() returned
+		for (size_t i = 0; i < term_ids.size(); ++i) {
+			entry &e = m_entries[term_ids[i]];
+			if (e.info.term.empty())
+				e.info.term = terms[i];
+			if (e.pending++ == 0)
+				++m_dirty;
+		}
+
+		need_flush = m_dirty >= flush_threshold;
+	}
+
+	if (need_flush)
+		flush();
+}
+
+// record is a sequence of [version, term, df increment] arrays appended one after another,
+// returns negative error code if record could not be read
+int term_dictionary::read_record(const dnet_raw_id &id, term_info &info)
+{
+	auto result = m_st.read_term_record(record_key(id));
+
+	if (result.error())
+		return result.error().code();
+	if (result.get().empty())
+		return -ENOENT;
+
+	const elliptics::data_pointer &data = result.get()[0].data;
+
+	size_t offset = 0;
+	while (offset < data.size()) {
+		msgpack::unpacked msg;
+		msgpack::unpack(&msg, data.data<char>(), data.size(), &offset);
+
+		const msgpack::object &o = msg.get();
+		if (o.type != msgpack::type::ARRAY || o.via.array.size != 3)
+			elliptics::throw_error(-EPROTO, "msgpack: term record array size mismatch: compiled: %d, unpacked: %d",
+					3, o.type == msgpack::type::ARRAY ? o.via.array.size : 0);
+
+		msgpack::object *p = o.via.array.ptr;
+
+		int ver;
+		p[0].convert(&ver);
+
+		if (ver != version)
+			elliptics::throw_error(-EPROTO, "msgpack: term record version mismatch: compiled: %d, unpacked: %d",
+					version, ver);
+
+		uint64_t increment;
+		p[1].convert(&info.term);
+		p[2].convert(&increment);
+
+		info.df += increment;
+	}
+
+	return 0;
+}
+
+bool term_dictionary::lookup(const dnet_raw_id &id, term_info &info)
+{
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		auto it = m_entries.find(id);
+		if (it != m_entries.end() && it->second.loaded) {
+			info = it->second.info;
+			info.df += it->second.pending;
+			return !info.term.empty();
+		}
+	}
+
+	// storage is read without lock, record may be concurrently appended by flush()
+	// or other indexers, cached frequency is approximate anyway
+	term_info stored;
+	const int err = read_record(id, stored);
+
+	std::unique_lock<std::mutex> guard(m_lock);
+
+	auto it = m_entries.find(id);
+
+	// storage failure, answer from cache and read record again next time
+	if (err && err != -ENOENT) {
+		if (it == m_entries.end())
+			return false;
+
+		info = it->second.info;
+		info.df += it->second.pending;
+		return !info.term.empty();
+	}
+
+	if (it == m_entries.end()) {
+		if (stored.term.empty())
+			return false;
+
+		it = m_entries.insert(std::make_pair(id, entry())).first;
+	}
+
+	entry &e = it->second;
+	if (!e.loaded) {
+		e.loaded = true;
+		e.info.df = stored.df;
+
+		if (e.info.term.empty() && !stored.term.empty()) {
+			e.info.term = stored.term;
+			m_ids.insert(std::make_pair(stored.term, id));
+		}
+	}
+
+	info = e.info;
+	info.df += e.pending;
+
+	shrink();
+	return !info.term.empty();
+}
+
+elliptics::id_to_name_map_t term_dictionary::names(const std::vector<dnet_raw_id> &ids)
+{
+	elliptics::id_to_name_map_t ret;
+
+	for (auto && id : ids) {
+		term_info info;
+		if (lookup(id, info))
+			ret[id] = info.term;
+	}
+
+	return ret;
+}
+
+void term_dictionary::flush()
+{
+	struct increment {
+		dnet_raw_id id;
+		std::string term;
+		uint64_t value;
+	};
+
+	std::vector<increment> increments;
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		increments.reserve(m_dirty);
+		for (auto && it : m_entries) {
+			entry &e = it.second;
+			if (!e.pending)
+				continue;
+
+			increments.push_back(increment{it.first, e.info.term, e.pending});
+
+			if (e.loaded)
+				e.info.df += e.pending;
+			e.pending = 0;
+		}
+
+		m_dirty = 0;
+	}
+
+	if (increments.empty())
+		return;
+
+	std::vector<async_write_result> results;
+	results.reserve(increments.size());
+	for (auto && inc : increments) {
+		msgpack::sbuffer buffer;
+		msgpack::packer<msgpack::sbuffer> packer(&buffer);
+
+		packer.pack_array(3);
+		packer.pack(static_cast<int>(version));
+		packer.pack(inc.term);
+		packer.pack(inc.value);
+
+		results.emplace_back(m_st.append_term_record(record_key(inc.id),
+					elliptics::data_pointer::copy(buffer.data(), buffer.size())));
+	}
+
+	size_t errors = 0;
+	for (size_t i = 0; i < results.size(); ++i) {
+		if (!results[i].error())
+			continue;
+
+		++errors;
+
+		// increment is returned back to pending, cached frequency does not include it yet
+		const increment &inc = increments[i];
+
+		std::unique_lock<std::mutex> guard(m_lock);
+		entry &e = m_entries[inc.id];
+		if (e.info.term.empty())
+			e.info.term = inc.term;
+		if (e.loaded)
+			e.info.df -= inc.value;
+		if (e.pending == 0)
+			++m_dirty;
+		e.pending += inc.value;
+	}
+
+	if (errors)
+		WOOKIE_LOG(log_error, "Term dictionary flush: terms: " << increments.size() << ", errors: " << errors);
+	else
+		WOOKIE_LOG(log_debug, "Term dictionary flush: terms: " << increments.size());
+}
+
+}} // namespace ioremap::wookie
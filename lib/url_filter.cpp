@@ -0,0 +1,148 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wookie/url_filter.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
+
+namespace ioremap { namespace wookie {
+
+aho_corasick::aho_corasick(const std::vector<std::string> &patterns)
+{
+	state root;
+	std::fill(root.next, root.next + 256, -1);
+	root.fail = 0;
+	root.match = 0;
+	m_states.push_back(root);
+
+	// trie of patterns
+	for (auto && p : patterns) {
+		if (p.empty())
+			continue;
+
+		int s = 0;
+		for (unsigned char c : p) {
+			if (m_states[s].next[c] < 0) {
+				state st;
+				std::fill(st.next, st.next + 256, -1);
+				st.fail = 0;
+				st.match = 0;
+
+				m_states[s].next[c] = m_states.size();
+				m_states.push_back(st);
+			}
+
+			s = m_states[s].next[c];
+		}
+
+		m_states[s].match = std::max<int>(m_states[s].match, p.size());
+	}
+
+	// breadth-first pass turns trie into automaton: missing transitions follow failure links,
+	// every state inherits matches of its failure state
+	std::deque<int> queue;
+	for (int c = 0; c < 256; ++c) {
+		int &n = m_states[0].next[c];
+		if (n < 0) {
+			n = 0;
+		} else {
+			m_states[n].fail = 0;
+			queue.push_back(n);
+		}
+	}
+
+	while (!queue.empty()) {
+		const int s = queue.front();
+		queue.pop_front();
+
+		for (int c = 0; c < 256; ++c) {
+			const int n = m_states[s].next[c];
+			const int fallback = m_states[m_states[s].fail].next[c];
+
+			if (n < 0) {
+				m_states[s].next[c] = fallback;
+				continue;
+			}
+
+			m_states[n].fail = fallback;
+			m_states[n].match = std::max(m_states[n].match, m_states[fallback].match);
+			queue.push_back(n);
+		}
+	}
+}
+
+bool aho_corasick::search(const std::string &text, bool skip_last) const
+{
+	if (empty())
+		return false;
+
+	int s = 0;
+	for (size_t i = 0; i < text.size(); ++i) {
+		s = m_states[s].next[(unsigned char)text[i]];
+
+		const int match = m_states[s].match;
+		if (!match)
+			continue;
+
+		if (!skip_last || i + 1 < text.size() || match > 1)
+			return true;
+	}
+
+	return false;
+}
+
+url_matcher::url_matcher(const url_filter_spec &spec) :
+m_any_port(spec.ports.empty()),
+m_words(spec.forbidden_words)
+{
+	for (auto && host : spec.hosts)
+		m_hosts.insert(boost::algorithm::to_lower_copy(host));
+
+	for (auto port : spec.ports) {
+		if (port <= 0 || port >= (int)m_ports.size())
+			throw std::invalid_argument("url filter: invalid port " + std::to_string(port));
+
+		m_ports.set(port);
+	}
+
+	for (auto && p : spec.forbidden_patterns)
+		m_patterns.emplace_back(p, std::regex::ECMAScript | std::regex::optimize);
+}
+
+bool url_matcher::check(const std::string &host, int port, const std::string &url) const
+{
+	if (!m_hosts.empty() && !m_hosts.count(boost::algorithm::to_lower_copy(host)))
+		return false;
+
+	if (!m_any_port && port && (port >= (int)m_ports.size() || !m_ports.test(port)))
+		return false;
+
+	if (m_words.search(url, true))
+		return false;
+
+	for (auto && re : m_patterns) {
+		if (std::regex_search(url, re))
+			return false;
+	}
+
+	return true;
+}
+
+}} // namespace ioremap::wookie
@@ -82,11 +82,11 @@ int main(int argc, char *argv[])
 				out.write(doc.data.c_str(), doc.data.size());
 			}
 		} else {
-			elliptics::session sess = engine.get_storage()->create_session();
-			k.transform(sess);
-
 			std::vector<dnet_raw_id> index;
-			index.push_back(k.raw_id());
+			if (url.size())
+				index = engine.get_storage()->transform_tokens(std::vector<std::string>(1, url));
+			else
+				index.push_back(k.raw_id());
 
 			std::vector<elliptics::find_indexes_result_entry> results;		
 			results = engine.get_storage()->find(index);
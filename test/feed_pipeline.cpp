@@ -3,6 +3,7 @@
 #include "wookie/parser.hpp"
 #include "wookie/dmanager.hpp"
 #include "wookie/engine.hpp"
+#include "wookie/log.hpp"
 
 #include <swarm/urlfetcher/url_fetcher.hpp>
 #include <swarm/urlfetcher/boost_event_loop.hpp>
@@ -57,14 +58,16 @@ struct feed_pipeline_processor
 
 	/*!
 	 * \brief Called on every downloaded document
-	 * \param reply Swarm reply about downloaded document
-	 * \param data Content of the document
+	 * \param ctx Downloaded document with swarm reply and its content
 	 */
-	void process_text(const ioremap::swarm::url_fetcher::response &reply, const std::string &data, document_type) {
+	void process_text(document_context &ctx, document_type) {
 		if (fallback) {
 			return;
 		}
 
+		const ioremap::swarm::url_fetcher::response &reply = ctx.reply();
+		const std::string &data = ctx.data();
+
 		try {
 			/*!
 			 * Create meta information about downloaded document and send it into pipeline
@@ -78,7 +81,7 @@ struct feed_pipeline_processor
 			 */
 			auto g = app->enqueue("process", meta_info);
 		} catch (const std::exception &e) {
-			std::cerr << reply.url().to_string() << ": feed pipeline exception: " << e.what() << std::endl;
+			WOOKIE_LOG(log_error, reply.url().to_string() << ": feed pipeline exception: " << e.what());
 			engine.download(reply.request().url());
 		}
 	}
@@ -102,41 +105,10 @@ struct feed_pipeline_processor
 		return std::bind(&feed_pipeline_processor::process_text,
 			std::make_shared<feed_pipeline_processor>(engine, base, fallback),
 			std::placeholders::_1,
-			std::placeholders::_2,
-			std::placeholders::_3);
+			std::placeholders::_2);
 	}
 };
 
-/*!
- * \brief Creates filter for urls. All urls with forbidden_words will be ignored by crawler.
- * \param forbidden_words List of forbidden words in url
- * \return Returns functor for filtering urls
- */
-url_filter_functor create_words_filter(const std::vector<std::string> &forbidden_words)
-{
-	struct filter
-	{
-		std::vector<std::string> forbidden_words;
-
-		filter(const std::vector<std::string> &forbidden_words) : forbidden_words(forbidden_words) {
-		}
-
-		bool check(const swarm::url &url) {
-			const std::string url_string = url.to_string();
-			for (auto &w : forbidden_words) {
-				std::string::size_type pos = url_string.find(w);
-				if ((pos != std::string::npos) && (pos != url_string.size() - 1))
-					return false;
-			}
-
-			return true;
-		}
-	};
-
-	return std::bind(&filter::check, std::make_shared<filter>(forbidden_words), std::placeholders::_2);
-}
-
-
 int main(int argc, char *argv[])
 {
 	using namespace boost::program_options;
@@ -167,15 +139,26 @@ int main(int argc, char *argv[])
 
 	try {
 		/*!
-		 * Crawled will only download pages with this ports
+		 * Links allowed to be crawled, it is compiled into single matcher
+		 */
+		wookie::url_filter_spec url_filter;
+
+		/*!
+		 * Crawl urls only in the same domain as \a url
 		 */
-		std::vector<int> allowed_ports = { 80, 8080 };
+		url_filter.hosts.push_back(ioremap::swarm::url(url).host());
+		if (url_filter.hosts.back().empty())
+			ioremap::elliptics::throw_error(-EINVAL, "Invalid URL '%s': base is empty", url.c_str());
+
+		/*!
+		 * Crawler will only download pages with these ports
+		 */
+		url_filter.ports = { 80, 8080 };
 
 		/*!
 		 * \brief List of forbidden words in urls. Crawler will skip all url containing any of this words.
 		 */
-		std::vector<std::string> forbidden_words;
-		forbidden_words.push_back("/blog");
+		url_filter.forbidden_words.push_back("/blog");
 
 		/*!
 		 * Filter that distinguishes text and images/audio/binary files
@@ -184,19 +167,14 @@ int main(int argc, char *argv[])
 		engine.add_filter(create_text_filter());
 
 		/*!
-		 * Filter for crawling urls only in the same domain as \a url
-		 */
-		engine.add_url_filter(create_domain_filter(url));
-
-		/*!
-		 * Filters out urls with forbidden words
+		 * The same check by Content-Type header, body of non-text replies is neither buffered nor parsed
 		 */
-		engine.add_url_filter(create_words_filter(forbidden_words));
+		engine.add_header_filter(create_text_header_filter());
 
 		/*!
-		 * Filters out urls on bad ports
+		 * Filters out urls from other domains, on bad ports and with forbidden words
 		 */
-		engine.add_url_filter(create_port_filter(allowed_ports));
+		engine.set_url_filter(url_filter);
 
 		/*!
 		 * Specifies strategy by which urls are extracted from document body
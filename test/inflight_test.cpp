@@ -0,0 +1,118 @@
+/*
+ * Copyright 2013+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wookie/inflight.hpp"
+#include "wookie/recrawl.hpp"
+
+#include <iostream>
+
+using namespace ioremap::wookie;
+
+#define check(cond) do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+			return -1; \
+		} \
+	} while (0)
+
+// URL found in page cache has already been claimed by the lookup, its refetch
+// must still carry cached document key and timestamp, otherwise '304 Not Modified'
+// reply can not be resolved to the stored body
+static int test_claimed_refetch()
+{
+	inflight_registry inflight;
+	const uint64_t id = inflight_registry::fingerprint("http://example.com/");
+
+	check(inflight.insert(id));
+	check(!inflight.insert(id));
+
+	document doc;
+	doc.key = "http://example.com/";
+	doc.ts.tsec = 1000;
+
+	inflight.update(id, doc);
+	check(inflight.size() == 1);
+
+	inflight_registry::entry e;
+	check(inflight.erase(id, e));
+	check(e.cached());
+	check(e.key == doc.key);
+	check(e.ts.tsec == 1000);
+	check(inflight.size() == 0);
+
+	// URL which has not been claimed is inserted
+	inflight.update(id, doc);
+	check(inflight.size() == 1);
+	check(!inflight.insert(id));
+
+	return 0;
+}
+
+// change history travels with in-flight entry of page cache refetch,
+// second fetch has to see the first one
+static int test_refetch_history()
+{
+	inflight_registry inflight;
+	recrawl_policy policy(3600, 30 * 24 * 3600);
+
+	const std::string url = "http://example.com/";
+	const uint64_t id = inflight_registry::fingerprint(url);
+
+	dnet_time now;
+	now.tsec = 1000000;
+	now.tnsec = 0;
+
+	// first fetch, URL is not in page cache
+	check(inflight.insert(id));
+
+	inflight_registry::entry e;
+	check(inflight.erase(id, e));
+	check(!e.recrawl.known());
+
+	recrawl_state st = e.recrawl;
+	policy.update(st, "body", false, now);
+	check(st.checks == 1);
+	check(st.interval == 3600);
+
+	// refetch of the stored page, server says it has not been changed
+	document doc;
+	doc.key = url;
+
+	check(inflight.insert(id));
+	inflight.update(id, doc, st);
+	check(inflight.erase(id, e));
+	check(e.recrawl.checks == 1);
+
+	st = e.recrawl;
+	now.tsec += st.interval;
+	policy.update(st, std::string(), true, now);
+	check(st.checks == 2);
+	check(st.changes == 0);
+	check(st.interval > 3600);
+
+	return 0;
+}
+
+int main()
+{
+	if (test_claimed_refetch())
+		return -1;
+	if (test_refetch_history())
+		return -1;
+
+	std::cout << "inflight: ok" << std::endl;
+	return 0;
+}
@@ -64,21 +64,10 @@ int main(int argc, char *argv[])
 	}
 
 	text = vm.count("text") != 0;
-	elliptics::key k(url);
 
 	try {
-		elliptics::session sess = engine.get_storage()->create_session();
-		k.transform(sess);
-
-		std::vector<dnet_raw_id> index;
-		index.push_back(k.raw_id());
-
 		std::vector<elliptics::find_indexes_result_entry> results;		
-		results = engine.get_storage()->find(index);
-
-		elliptics::session data_sess = engine.get_storage()->create_session();
-		if (text)
-			data_sess.set_namespace("text", 4);
+		results = engine.get_storage()->find(std::vector<std::string>(1, url));
 
 		std::vector<std::string> urls;
 		for (auto r : results) {
@@ -88,11 +77,13 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		elliptics::async_read_result bres = data_sess.bulk_read(urls);
+		wookie::async_read_result bres = text ?
+			engine.get_storage()->backend().bulk_read("text", urls) :
+			engine.get_storage()->bulk_read_data(urls);
 
 		if (!msgin.size() || !gram.size()) {
-			for (const auto &b : bres) {
-				wookie::document doc = wookie::storage::unpack_document(b.file());
+			for (const auto &b : bres.get()) {
+				wookie::document doc = wookie::storage::unpack_document(b.data);
 				std::cout << doc << std::endl;
 			}
 
@@ -111,8 +102,8 @@ int main(int argc, char *argv[])
 
 //		std::vector<ioremap::warp::grammar> vgram = l.generate(tokens);
 
-//		for (const auto &b : bres) {
-//			wookie::document doc = wookie::storage::unpack_document(b.file());
+//		for (const auto &b : bres.get()) {
+//			wookie::document doc = wookie::storage::unpack_document(b.data);
 
 //			std::vector<std::string> sentences;
 //			boost::split(sentences, doc.data, boost::is_any_of("|"));
@@ -22,6 +22,8 @@
 #include "wookie/engine.hpp"
 #include "wookie/index_data.hpp"
 #include "wookie/basic_elliptics_splitter.hpp"
+#include "wookie/log.hpp"
+#include "wookie/metrics.hpp"
 
 #include <boost/program_options.hpp>
 
@@ -39,8 +41,11 @@ struct rindex_processor
 
 	basic_elliptics_splitter m_splitter;
 
+	wookie::histogram &index_write_time;
+
 	rindex_processor(wookie::engine &engine, const std::string &base, bool fallback)
-		: engine(engine), base(base), fallback(fallback) {
+		: engine(engine), base(base), fallback(fallback),
+		index_write_time(engine.get_metrics().get_histogram("index_write_time")) {
 	}
 
 	void process(const std::string &url, const std::string &content,
@@ -51,9 +56,20 @@ struct rindex_processor
 		m_splitter.prepare_indexes(url, content, ts, base_index, ids, objs);
 
 		if (ids.size()) {
-			std::cout << "Rindex update ... url: " << url << ": indexes: " << ids.size() << std::endl;
-			engine.get_storage()->create_session().set_indexes(url, ids, objs).wait();
-			std::cout << "Rindex update finished" << std::endl;
+			WOOKIE_LOG(log_info, "Rindex update ... url: " << url << ": indexes: " << ids.size());
+
+			// indexes are written in batches together with other documents, processing does not wait for them
+			wookie::histogram &write_time = index_write_time;
+			wookie::timer started;
+			engine.get_storage()->indexer().add(url, ids, objs,
+				[&write_time, url, started] (const elliptics::error_info &error) {
+					write_time.observe(started.elapsed_us());
+
+					if (error)
+						WOOKIE_LOG(log_error, "Rindex update failed: url: " << url << ", error: " << error.message());
+					else
+						WOOKIE_LOG(log_debug, "Rindex update finished: url: " << url);
+				});
 		}
 
 		document doc;
@@ -64,28 +80,22 @@ struct rindex_processor
 
 		elliptics::data_pointer ptr = storage::pack_document(doc);
 
-		elliptics::session sess = engine.get_storage()->create_session();
-
-		std::string ns = "text";
-		sess.set_namespace(ns.c_str(), ns.size());
-
-		sess.write_data(doc.key, ptr, 0).wait();
-		std::cout << "RIndex process finished" << std::endl;
+		engine.get_storage()->backend().write("text", doc.key, ptr).wait();
+		WOOKIE_LOG(log_debug, "RIndex process finished: url: " << url);
 	}
 
-	void process_text(const ioremap::swarm::url_fetcher::response &reply, const std::string &data, document_type) {
+	void process_text(document_context &ctx, document_type) {
 		struct dnet_time ts;
 		dnet_current_time(&ts);
 
-		parser p;
-		// fallback is a processor which handles replies which are forbidden by filters
-		if (!fallback)
-			p.feed_text(data);
+		const ioremap::swarm::url_fetcher::response &reply = ctx.reply();
 
 		try {
-			process(reply.url().to_string(), p.text(" "), ts, base + ".collection");
+			// fallback is a processor which handles replies which are forbidden by filters,
+			// their content is not parsed
+			process(reply.url().to_string(), fallback ? std::string() : ctx.text(), ts, base + ".collection");
 		} catch (const std::exception &e) {
-			std::cerr << reply.url().to_string() << ": index processing exception: " << e.what() << std::endl;
+			WOOKIE_LOG(log_error, reply.url().to_string() << ": index processing exception: " << e.what());
 			engine.download(reply.request().url());
 		}
 	}
@@ -102,36 +112,10 @@ struct rindex_processor
 		return std::bind(&rindex_processor::process_text,
 			std::make_shared<rindex_processor>(engine, base, fallback),
 			std::placeholders::_1,
-			std::placeholders::_2,
-			std::placeholders::_3);
+			std::placeholders::_2);
 	}
 };
 
-url_filter_functor create_words_filter(const std::vector<std::string> &forbidden_words)
-{
-	struct filter
-	{
-		std::vector<std::string> forbidden_words;
-
-		filter(const std::vector<std::string> &forbidden_words) : forbidden_words(forbidden_words) {
-		}
-
-		bool check(const swarm::url &url) {
-			const std::string url_string = url.to_string();
-			for (auto &w : forbidden_words) {
-				std::string::size_type pos = url_string.find(w);
-				if ((pos != std::string::npos) && (pos != url_string.size() - 1))
-					return false;
-			}
-
-			return true;
-		}
-	};
-
-	return std::bind(&filter::check, std::make_shared<filter>(forbidden_words), std::placeholders::_2);
-}
-
-
 int main(int argc, char *argv[])
 {
 	using namespace boost::program_options;
@@ -181,6 +165,7 @@ int main(int argc, char *argv[])
 					std::cout << dnet_dump_id_len_raw(r.id, DNET_ID_SIZE, tmp_str) << std::endl;
 				}
 			} else {
+				// rift serializer consumes elliptics read results, JSON output requires elliptics storage backend
 				elliptics::session sess = engine.get_storage()->create_session();
 
 				sess.set_ioflags(DNET_IO_FLAGS_CACHE);
@@ -216,15 +201,14 @@ int main(int argc, char *argv[])
 				std::cout << result_object.ToString() << std::endl;
 			}
 		} else {
-			std::vector<int> allowed_ports = { 80, 8080 };
-
-			std::vector<std::string> forbidden_words;
-			forbidden_words.push_back("/blog");
+			wookie::url_filter_spec url_filter;
+			url_filter.hosts.push_back(ioremap::swarm::url(url).host());
+			url_filter.ports = { 80, 8080 };
+			url_filter.forbidden_words.push_back("/blog");
 
 			engine.add_filter(create_text_filter());
-			engine.add_url_filter(create_domain_filter(url));
-			engine.add_url_filter(create_words_filter(forbidden_words));
-			engine.add_url_filter(create_port_filter(allowed_ports));
+			engine.add_header_filter(create_text_header_filter());
+			engine.set_url_filter(url_filter);
 			engine.add_parser(create_href_parser());
 			engine.add_processor(rindex_processor::create(engine, url, false));
 			engine.add_fallback_processor(rindex_processor::create(engine, url, true));